@@ -25,33 +25,181 @@ https://www.acid.org/info/sauce/sauce.htm
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "ansr.h"
 
-#define ANSR_MIN_ALLOC_PARAMS	2
 #define ANSR_MIN_ALLOC_ROWS	64
 #define ANSR_MIN_ALLOC_COLS	80
+#define ANSR_MIN_ALLOC_DISP_STATES	16
+#define ANSR_MIN_ALLOC_RUNS	4
+#define ANSR_MIN_ALLOC_RUN_COLS	16
+#define ANSR_MIN_ALLOC_SPARE_ROWS	16
+#define ANSR_MAX_DISP_STATES	65536	/* ansr_row_t.disp_states[] are 16-bit */
+#define ANSR_MAX_PARAMS		16	/* CSI params kept, sequences with more are malformed */
+#define ANSR_SPARSE_GAP		8	/* blank cols bridged within a run rather than starting another */
+#define ANSR_SGR_CACHE_SIZE	256	/* power of 2 */
+#define ANSR_SGR_CACHE_PARAMS	8	/* longest SGR param list cached */
+#define ANSR_ARENA_SLAB_SIZE	(64 * 1024)
+#define ANSR_ARENA_MAX_SLAB_SIZE	(16 * 1024 * 1024)	/* default slabs double up to this */
+#define ANSR_ARENA_ALIGN	16
 
 #define MAX(a, b)	((a) > (b) ? (a) : (b))
 #define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define ANSR_ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+#define ALIGN(n, a)	(((n) + (a) - 1) & ~((size_t)(a) - 1))
+
+typedef struct ansr_slab_t ansr_slab_t;
+
+struct ansr_slab_t {
+	ansr_slab_t		*next;
+	size_t			size, used;
+};
+
+#define ANSR_SLAB_DATA(_slab)	((char *)(_slab) + ALIGN(sizeof(ansr_slab_t), ANSR_ARENA_ALIGN))
+
+struct ansr_arena_t {
+	ansr_allocator_t	allocator;
+	size_t			slab_size;		/* of the next slab */
+	int			grow_slabs;		/* double slab_size with every slab */
+	ansr_slab_t		*slabs, *current;
+	void			*last;			/* most recent allocation, may grow in place */
+	size_t			bytes;			/* held by the arena and its slabs */
+};
 
 typedef enum ansr_state_t {
 	ANSR_STATE_INPUT,
 	ANSR_STATE_EOF,
 	ANSR_STATE_ESCAPE,
 	ANSR_STATE_CSI,
+	ANSR_STATE_CNT
 } ansr_state_t;
 
+/* what ansr_write() does with an input byte, per _ansr_action(state, byte) */
+typedef enum ansr_action_t {
+	ANSR_ACTION_TEXT,		/* place the run of text starting here */
+	ANSR_ACTION_IGNORE,
+	ANSR_ACTION_BS,
+	ANSR_ACTION_HT,
+	ANSR_ACTION_LF,
+	ANSR_ACTION_CR,
+	ANSR_ACTION_CONTROL,		/* unsupported C0 control */
+	ANSR_ACTION_SUB,
+	ANSR_ACTION_ESC,
+	ANSR_ACTION_ESC_CSI,
+	ANSR_ACTION_ESC_FINAL,		/* end of an unsupported escape sequence */
+	ANSR_ACTION_CSI_PARAM,		/* digits */
+	ANSR_ACTION_CSI_SEP,
+	ANSR_ACTION_CSI_PRIVATE,	/* private params and intermediate bytes */
+	ANSR_ACTION_CSI_FINAL,
+	ANSR_ACTION_ABORT,		/* byte cuts the sequence short, handle it as input */
+} ansr_action_t;
+
+#if defined(ANSR_SWITCH_ACTIONS)
+#include "bench_parse_switch.h"
+
+static inline ansr_action_t _ansr_action(ansr_state_t state, unsigned char c)
+{
+	return _ansr_switch_action(state, c);
+}
+#else
+static const uint8_t ansr_actions[ANSR_STATE_CNT][256] = {
+	[ANSR_STATE_INPUT] = {
+		[0x00 ... 0xff] = ANSR_ACTION_TEXT,
+		[0x07] = ANSR_ACTION_IGNORE,	/* BELL - tingaling */
+		[0x08] = ANSR_ACTION_BS,	/* Backspace - move cursor back horizontally */
+		[0x09] = ANSR_ACTION_HT,	/* HT - horizontal tab */
+		[0x0a] = ANSR_ACTION_LF,	/* LF - move to next line, scroll display up if at bottom of screen, no horiz change */
+		[0x0c] = ANSR_ACTION_CONTROL,	/* FF - move to start of new page but not changing horizontally */
+		[0x0d] = ANSR_ACTION_CR,	/* CR - move the cursor to column 0 */
+		[0x1a] = ANSR_ACTION_SUB,	/* SUB / EOF */
+		[0x1b] = ANSR_ACTION_ESC,	/* ESC */
+		[0x7f] = ANSR_ACTION_IGNORE,	/* DEL */
+	},
+
+	[ANSR_STATE_EOF] = {
+		/* just discard everything after EOF.
+		 * SAUCE parsing is deliberately not handled by libansr.
+		 */
+		[0x00 ... 0xff] = ANSR_ACTION_IGNORE,
+	},
+
+	[ANSR_STATE_ESCAPE] = {
+		/* TODO: "Fe Escape sequences" / C0 C1 handling? */
+		[0x00 ... 0xff] = ANSR_ACTION_ABORT,
+		[0x20 ... 0x2f] = ANSR_ACTION_IGNORE,		/* "nF" sequence intermediate bytes, the sequence continues */
+		[0x30 ... 0x7e] = ANSR_ACTION_ESC_FINAL,	/* final byte of some other escape sequence, skipped */
+		[0x5b] = ANSR_ACTION_ESC_CSI,			/* '[' */
+	},
+
+	[ANSR_STATE_CSI] = {
+		[0x00 ... 0xff] = ANSR_ACTION_ABORT,
+		[0x30 ... 0x39] = ANSR_ACTION_CSI_PARAM,	/* CSI "parameter bytes" 0-9 */
+		[0x3a] = ANSR_ACTION_CSI_SEP,			/* CSI "parameter bytes" ':', sub-parameter separator e.g. 38:5:n, treated like ';' */
+		[0x3b] = ANSR_ACTION_CSI_SEP,			/* CSI "parameter bytes" ';' */
+		[0x3c ... 0x3f] = ANSR_ACTION_CSI_PRIVATE,	/* "private" CSI "parameter bytes" */
+		[0x20 ... 0x2f] = ANSR_ACTION_CSI_PRIVATE,	/* "nF" sequence intermediate bytes */
+		[0x40 ... 0x6f] = ANSR_ACTION_CSI_FINAL,	/* final bytes */
+		[0x70 ... 0x7e] = ANSR_ACTION_CSI_FINAL,	/* "private" final bytes */
+	},
+};
+
+
+static inline ansr_action_t _ansr_action(ansr_state_t state, unsigned char c)
+{
+	return ansr_actions[state][c];
+}
+#endif
+
+#define ANSR_DISP_WORDS		(sizeof(ansr_disp_state_t) / sizeof(uint32_t))
+
+/* the effect of an SGR param list on the words of a disp_state: (word & ~mask) | value */
+typedef struct ansr_sgr_cache_t {
+	uint8_t			n_params;		/* 0 when empty */
+	uint16_t		params[ANSR_SGR_CACHE_PARAMS];
+	uint32_t		mask[ANSR_DISP_WORDS], value[ANSR_DISP_WORDS];
+} ansr_sgr_cache_t;
+
+typedef struct ansr_measure_t {
+	unsigned	width, height;
+} ansr_measure_t;
+
 typedef struct _ansr_t {
 	ansr_t			public;
 	ansr_state_t		state;
 	ansr_disp_state_t	disp_state;
+	uint16_t		disp_handle;		/* interned disp_state, stale when disp_dirty */
+	int			disp_dirty;
 	unsigned		cursor_x, cursor_y;
-	size_t			n_params_allocated, n_params;
+	size_t			n_params;
 	unsigned		accumulator;
-	char			*params;
+	int			csi_private;		/* CSI has private params or intermediate bytes */
+	int			csi_malformed;		/* CSI has too many params or one too large */
+	uint16_t		params[ANSR_MAX_PARAMS];
+	ansr_arena_t		*arena;			/* conf.arena or the private one owned */
+	int			own_arena;
+	int			presize_pending;	/* conf.expected_* layout deferred to the next ansr_write() */
+	ansr_measure_t		*measure;		/* set by ansr_measure(), spans only extend it */
+	unsigned		n_event_widths;
+	unsigned		*event_widths;		/* event mode has no rows, the width each would have */
+	size_t			arena_bytes;		/* taken from arena on our behalf, including abandoned */
+	unsigned		n_reallocs;		/* growths of already allocated storage */
+	size_t			n_clipped;		/* cells dropped for exceeding conf.max_rows/max_cols */
+	unsigned		n_rows_shared;		/* rows sharing another's storage after ansr_dedup() */
+	size_t			bytes_shared;		/* storage those rows would take otherwise */
+	unsigned		n_spare_rows, n_spare_rows_allocated;
+	ansr_row_t		**spare_rows;		/* cleared rows ansr_dedup() freed up, for reuse */
+	ansr_unsupported_t	unsupported;
+	unsigned		n_disp_states_allocated;
+	size_t			n_disp_buckets;		/* power of 2 */
+	uint32_t		*disp_buckets;		/* open addressed handle + 1, 0 when empty */
+	unsigned		n_sgr_cache_hits, n_sgr_cache_misses;
+	ansr_sgr_cache_t	sgr_cache[ANSR_SGR_CACHE_SIZE];	/* direct mapped by _ansr_sgr_hash() */
 } _ansr_t;
 
 
@@ -61,570 +209,2119 @@ static ansr_conf_t ansr_conf_defaults = {
 };
 
 
-/* create a new ansi renderer of width,height dimensions, starts completely cleared.
- * if input is non-NULL it will be applied to the newly created ans.
+static void * _ansr_malloc(const ansr_allocator_t *allocator, size_t size)
+{
+	if (allocator->malloc)
+		return allocator->malloc(allocator->ctx, size);
+
+	return malloc(size);
+}
+
+
+static void * _ansr_calloc(const ansr_allocator_t *allocator, size_t size)
+{
+	void	*ptr;
+
+	if (!allocator->malloc)
+		return calloc(1, size);
+
+	ptr = allocator->malloc(allocator->ctx, size);
+	if (ptr)
+		memset(ptr, 0, size);
+
+	return ptr;
+}
+
+
+static void * _ansr_realloc(const ansr_allocator_t *allocator, void *ptr, size_t old_size, size_t size)
+{
+	void	*new;
+
+	if (!allocator->malloc)
+		return realloc(ptr, size);
+
+	if (allocator->realloc)
+		return allocator->realloc(allocator->ctx, ptr, old_size, size);
+
+	new = allocator->malloc(allocator->ctx, size);
+	if (!new)
+		return NULL;
+
+	if (ptr) {
+		memcpy(new, ptr, MIN(old_size, size));
+		allocator->free(allocator->ctx, ptr, old_size);
+	}
+
+	return new;
+}
+
+
+static void _ansr_free(const ansr_allocator_t *allocator, void *ptr, size_t size)
+{
+	if (!ptr)
+		return;
+
+	if (allocator->free)
+		allocator->free(allocator->ctx, ptr, size);
+	else
+		free(ptr);
+}
+
+
+/* create a new arena allocating slab_size slabs through allocator (NULL for libc).
+ * slab_size 0 starts small and doubles the slabs as the arena grows, so big
+ * canvases take few slabs and are released in as few frees.
  */
-ansr_t * ansr_new(ansr_conf_t *conf, char *input, size_t input_len)
+ansr_arena_t * ansr_arena_new(ansr_allocator_t *allocator, size_t slab_size)
 {
-	_ansr_t	*_ansr;
+	ansr_allocator_t	libc = {};
+	ansr_arena_t		*arena;
+
+	if (!allocator)
+		allocator = &libc;
+
+	assert(!allocator->malloc == !allocator->free);
+
+	arena = _ansr_calloc(allocator, sizeof(*arena));
+	if (!arena)
+		return NULL;
+
+	arena->allocator = *allocator;
+	arena->bytes = sizeof(*arena);
+	arena->slab_size = slab_size ? slab_size : ANSR_ARENA_SLAB_SIZE;
+	arena->grow_slabs = !slab_size;
+
+	return arena;
+}
+
+
+/* release everything allocated from arena at once, the slabs are kept for reuse.
+ * every ansr_t using arena must be freed (or reset) first.
+ */
+void ansr_arena_reset(ansr_arena_t *arena)
+{
+	assert(arena);
+
+	for (ansr_slab_t *slab = arena->slabs; slab; slab = slab->next)
+		slab->used = 0;
+
+	arena->current = arena->slabs;
+	arena->last = NULL;
+}
+
+
+ansr_arena_t * ansr_arena_free(ansr_arena_t *arena)
+{
+	if (arena) {
+		ansr_allocator_t	allocator = arena->allocator;
+		ansr_slab_t		*next;
+
+		for (ansr_slab_t *slab = arena->slabs; slab; slab = next) {
+			next = slab->next;
+			_ansr_free(&allocator, slab, ALIGN(sizeof(ansr_slab_t), ANSR_ARENA_ALIGN) + slab->size);
+		}
+
+		_ansr_free(&allocator, arena, sizeof(*arena));
+	}
+
+	return NULL;
+}
+
+
+/* allocate size bytes from arena, uninitialized.
+ * a new slab is made no larger than max_slab (0 for unlimited) unless size needs it.
+ */
+static void * _ansr_arena_alloc(ansr_arena_t *arena, size_t size, size_t max_slab)
+{
+	ansr_slab_t	*slab = arena->current;
+	void		*ptr;
+
+	size = ALIGN(size, ANSR_ARENA_ALIGN);
+
+	/* after a reset there may be more slabs past current to reuse */
+	while (slab && slab->size - slab->used < size)
+		slab = slab->next;
+
+	if (!slab) {
+		size_t	slab_size = arena->slab_size;
+
+		if (max_slab)
+			slab_size = MIN(slab_size, ALIGN(max_slab, ANSR_ARENA_ALIGN));
+		slab_size = MAX(slab_size, size);
+
+		slab = _ansr_malloc(&arena->allocator, ALIGN(sizeof(ansr_slab_t), ANSR_ARENA_ALIGN) + slab_size);
+		if (!slab)
+			return NULL;
+
+		slab->size = slab_size;
+		slab->used = 0;
+		slab->next = NULL;
+		arena->bytes += ALIGN(sizeof(ansr_slab_t), ANSR_ARENA_ALIGN) + slab_size;
+
+		if (arena->grow_slabs)
+			arena->slab_size = MIN(arena->slab_size * 2, ANSR_ARENA_MAX_SLAB_SIZE);
+
+		/* keep the list in allocation order so reset reuses it front to back */
+		if (arena->current) {
+			ansr_slab_t	*tail = arena->current;
+
+			while (tail->next)
+				tail = tail->next;
+
+			tail->next = slab;
+		} else {
+			arena->slabs = slab;
+		}
+	}
+
+	ptr = ANSR_SLAB_DATA(slab) + slab->used;
+	slab->used += size;
+	arena->current = slab;
+	arena->last = ptr;
+
+	return ptr;
+}
+
+
+/* can size bytes be allocated from arena without adding a slab? */
+static int _ansr_arena_room(ansr_arena_t *arena, size_t size)
+{
+	size = ALIGN(size, ANSR_ARENA_ALIGN);
+
+	for (ansr_slab_t *slab = arena->current; slab; slab = slab->next) {
+		if (slab->size - slab->used >= size)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/* grow ptr of old_size to size bytes, in place when it's the most recent allocation.
+ * the old allocation is otherwise abandoned until the arena is reset.
+ * max_slab is as for _ansr_arena_alloc().
+ */
+static void * _ansr_arena_realloc(ansr_arena_t *arena, void *ptr, size_t old_size, size_t size, size_t max_slab)
+{
+	void	*new;
+
+	if (ptr && ptr == arena->last) {
+		ansr_slab_t	*slab = arena->current;
+		size_t		offset = (char *)ptr - ANSR_SLAB_DATA(slab);
+
+		if (slab->size - offset >= ALIGN(size, ANSR_ARENA_ALIGN)) {
+			slab->used = offset + ALIGN(size, ANSR_ARENA_ALIGN);
+
+			return ptr;
+		}
+	}
+
+	new = _ansr_arena_alloc(arena, size, max_slab);
+	if (!new)
+		return NULL;
+
+	if (ptr)
+		memcpy(new, ptr, MIN(old_size, size));
+
+	return new;
+}
+
+
+/* everything held on _ansr's behalf, as charged against conf.max_bytes and
+ * reported by ansr_stats(): a private arena is charged whole, slab slack and
+ * all, a caller-supplied one only for what's been taken from it.
+ */
+static inline size_t _ansr_bytes(_ansr_t *_ansr)
+{
+	return	sizeof(*_ansr) +
+		_ansr->n_disp_states_allocated * sizeof(*_ansr->public.disp_states) +
+		_ansr->n_disp_buckets * sizeof(*_ansr->disp_buckets) +
+		(_ansr->own_arena ? _ansr->arena->bytes : _ansr->arena_bytes);
+}
+
+
+/* can size more bytes be allocated within conf.max_bytes? */
+static inline int _ansr_fits(_ansr_t *_ansr, size_t size)
+{
+	if (!_ansr->public.conf.max_bytes)
+		return 1;
+
+	return _ansr_bytes(_ansr) + ALIGN(size, ANSR_ARENA_ALIGN) <= _ansr->public.conf.max_bytes;
+}
+
+
+/* can size bytes be taken from the arena within conf.max_bytes?
+ * a private arena only costs anything when it needs another slab.
+ */
+static inline int _ansr_arena_fits(_ansr_t *_ansr, size_t size)
+{
+	if (!_ansr->own_arena || !_ansr->public.conf.max_bytes)
+		return _ansr_fits(_ansr, size);
+
+	if (_ansr_arena_room(_ansr->arena, size))
+		return 1;
+
+	return _ansr_fits(_ansr, ALIGN(sizeof(ansr_slab_t), ANSR_ARENA_ALIGN) + ALIGN(size, ANSR_ARENA_ALIGN));
+}
+
+
+/* the largest slab worth adding to the arena for _ansr, what's left of conf.max_bytes.
+ * slabs outgrowing that would hold memory the budget can never use, for a
+ * private arena they'd exceed it.
+ */
+static inline size_t _ansr_max_slab(_ansr_t *_ansr)
+{
+	size_t	bytes;
+
+	if (!_ansr->public.conf.max_bytes)
+		return 0;
+
+	bytes = _ansr_bytes(_ansr);
+	if (_ansr->own_arena)
+		bytes += ALIGN(sizeof(ansr_slab_t), ANSR_ARENA_ALIGN);
+
+	if (bytes + ANSR_ARENA_ALIGN > _ansr->public.conf.max_bytes)
+		return 1;
+
+	return (_ansr->public.conf.max_bytes - bytes) & ~(size_t)(ANSR_ARENA_ALIGN - 1);
+}
+
+
+/* grow ptr from old_size to size bytes in _ansr's arena, keeping count for ansr_stats() */
+static void * _ansr_grow(_ansr_t *_ansr, void *ptr, size_t old_size, size_t size)
+{
+	void	*new;
+
+	new = _ansr_arena_realloc(_ansr->arena, ptr, old_size, size, _ansr_max_slab(_ansr));
+	if (!new)
+		return NULL;
+
+	if (new == ptr)
+		_ansr->arena_bytes += ALIGN(size, ANSR_ARENA_ALIGN) - ALIGN(old_size, ANSR_ARENA_ALIGN);
+	else
+		_ansr->arena_bytes += ALIGN(size, ANSR_ARENA_ALIGN);
+
+	if (ptr)
+		_ansr->n_reallocs++;
+
+	return new;
+}
+
+
+static inline unsigned _ansr_max_rows(_ansr_t *_ansr)
+{
+	return _ansr->public.conf.max_rows ? _ansr->public.conf.max_rows : UINT_MAX;
+}
+
+
+static inline unsigned _ansr_max_cols(_ansr_t *_ansr)
+{
+	if (_ansr->public.stride) /* conf.grid rows can't grow */
+		return _ansr->public.stride;
+
+	return _ansr->public.conf.max_cols ? _ansr->public.conf.max_cols : UINT_MAX;
+}
+
+
+/* are rows made of runs? */
+static inline int _ansr_sparse(_ansr_t *_ansr)
+{
+	return _ansr->public.conf.sparse && !_ansr->public.stride;
+}
+
+
+/* the fixed row stride for a conf.grid canvas at least width wide, 0 for separately allocated rows */
+static unsigned _ansr_stride(const ansr_conf_t *conf, unsigned width)
+{
+	if (!conf->grid || conf->events.span)
+		return 0;
+
+	width = MAX(width, conf->screen_width);
+	if (conf->max_cols)
+		width = MIN(width, conf->max_cols);
+
+	return width;
+}
+
+
+/* pack every field of disp_state into a single comparable/hashable word */
+static uint32_t _ansr_disp_pack(const ansr_disp_state_t *disp_state)
+{
+	uint32_t	packed = 0;
+	unsigned	bit = 8;
+
+	packed |= disp_state->colors.fg & 0xf;
+	packed |= (disp_state->colors.bg & 0xf) << 4;
+
+#define PACK(_attr)	packed |= (uint32_t)disp_state->attrs._attr << bit++;
+	PACK(bold);
+	PACK(faint);
+	PACK(italic);
+	PACK(underline);
+	PACK(slow_blink);
+	PACK(rapid_blink);
+	PACK(invert);
+	PACK(conceal);
+	PACK(strikeout);
+	PACK(double_underline);
+	PACK(proportional);
+	PACK(framed);
+	PACK(encircled);
+	PACK(overlined);
+	PACK(ideogram_underline);
+	PACK(ideogram_double_underline);
+	PACK(ideogram_overline);
+	PACK(ideogram_double_overline);
+	PACK(ideogram_stress);
+	PACK(superscript);
+	PACK(subscript);
+#undef PACK
+
+	return packed;
+}
+
+
+static inline size_t _ansr_disp_hash(uint32_t key)
+{
+	key ^= key >> 16;
+	key *= 0x85ebca6b;
+	key ^= key >> 13;
+
+	return key;
+}
+
+
+/* (re)build the disp_buckets hash at n_buckets (a power of 2) from the interned keys */
+static int _ansr_disp_rehash(_ansr_t *_ansr, size_t n_buckets)
+{
+	uint32_t	*buckets;
+
+	if (!_ansr_fits(_ansr, n_buckets * sizeof(*buckets)))
+		return -ENOSPC;
+
+	buckets = _ansr_calloc(&_ansr->public.conf.allocator, n_buckets * sizeof(*buckets));
+	if (!buckets)
+		return -ENOMEM;
+
+	for (unsigned i = 0; i < _ansr->public.n_disp_states; i++) {
+		size_t	b = _ansr_disp_hash(_ansr_disp_pack(&_ansr->public.disp_states[i])) & (n_buckets - 1);
+
+		while (buckets[b])
+			b = (b + 1) & (n_buckets - 1);
+
+		buckets[b] = i + 1;
+	}
+
+	_ansr_free(&_ansr->public.conf.allocator, _ansr->disp_buckets, _ansr->n_disp_buckets * sizeof(*_ansr->disp_buckets));
+	_ansr->disp_buckets = buckets;
+	_ansr->n_disp_buckets = n_buckets;
+
+	return 0;
+}
+
+
+/* returns the handle of disp_state in public.disp_states, adding it if new */
+/* returns -errno on failure (ENOMEM, ENOSPC, EOVERFLOW) */
+static int _ansr_disp_intern(_ansr_t *_ansr, const ansr_disp_state_t *disp_state)
+{
+	uint32_t	key = _ansr_disp_pack(disp_state);
+	unsigned	n = _ansr->public.n_disp_states;
+	size_t		b;
+
+	if ((n + 1) * 2 > _ansr->n_disp_buckets) {
+		int	r;
+
+		r = _ansr_disp_rehash(_ansr, MAX(ANSR_MIN_ALLOC_DISP_STATES * 2, _ansr->n_disp_buckets * 2));
+		if (r < 0)
+			return r;
+	}
+
+	for (b = _ansr_disp_hash(key) & (_ansr->n_disp_buckets - 1); _ansr->disp_buckets[b]; b = (b + 1) & (_ansr->n_disp_buckets - 1)) {
+		if (_ansr_disp_pack(&_ansr->public.disp_states[_ansr->disp_buckets[b] - 1]) == key)
+			return _ansr->disp_buckets[b] - 1;
+	}
+
+	if (n == ANSR_MAX_DISP_STATES)
+		return -EOVERFLOW;
+
+	if (n == _ansr->n_disp_states_allocated) {
+		unsigned		newsize = MAX(ANSR_MIN_ALLOC_DISP_STATES, n * 2);
+		ansr_disp_state_t	*new;
+
+		if (!_ansr_fits(_ansr, newsize * sizeof(*new)))
+			return -ENOSPC;
+
+		new = _ansr_realloc(&_ansr->public.conf.allocator, _ansr->public.disp_states, _ansr->n_disp_states_allocated * sizeof(*new), newsize * sizeof(*new));
+		if (!new)
+			return -ENOMEM;
+
+		if (_ansr->public.disp_states)
+			_ansr->n_reallocs++;
+
+		_ansr->public.disp_states = new;
+		_ansr->n_disp_states_allocated = newsize;
+	}
+
+	_ansr->public.disp_states[n] = *disp_state;
+	_ansr->disp_buckets[b] = n + 1;
+	_ansr->public.n_disp_states++;
+
+	return n;
+}
+
+
+/* returns the handle for the current disp_state, interning it if changed */
+/* returns -errno on failure */
+static inline int _ansr_disp_handle(_ansr_t *_ansr)
+{
+	if (_ansr->disp_dirty) {
+		int	r;
+
+		r = _ansr_disp_intern(_ansr, &_ansr->disp_state);
+		if (r < 0)
+			return r;
+
+		_ansr->disp_handle = r;
+		_ansr->disp_dirty = 0;
+	}
+
+	return _ansr->disp_handle;
+}
+
+
+/* size of a row allocation holding width cols */
+static inline size_t _ansr_row_size(size_t width)
+{
+	return sizeof(ansr_row_t) + width * (sizeof(uint16_t) + sizeof(char));
+}
+
+
+/* grow the conf.grid canvas to hold at least height rows of stride cells.
+ * the canvas is one block of the rows array, the row headers, then the
+ * disp_states and codes planes, with the rows being views into the planes.
+ * returns -errno on failure (ENOMEM, ENOSPC)
+ */
+static int _ansr_grid_reserve(_ansr_t *_ansr, size_t height)
+{
+	ansr_t		*ansr = &_ansr->public;
+	size_t		stride = ansr->stride, new_height, size;
+	unsigned	old_height = ansr->allocated_height;
+	ansr_row_t	**rows, *headers;
+	uint16_t	*disp_states;
+	char		*block, *codes;
+
+	if (height <= old_height)
+		return 0;
+
+	new_height = MAX(ANSR_MIN_ALLOC_ROWS, (size_t)old_height * 2);
+	new_height = MAX(new_height, height);
+	new_height = MIN(new_height, _ansr_max_rows(_ansr));
+
+#define GRID_SIZE(_height)					\
+	(ALIGN((_height) * sizeof(*rows), ANSR_ARENA_ALIGN) +	\
+	 ALIGN((_height) * sizeof(*headers), ANSR_ARENA_ALIGN) +	\
+	 ALIGN((_height) * stride * sizeof(*disp_states), ANSR_ARENA_ALIGN) + \
+	 (_height) * stride)
+
+	size = GRID_SIZE(new_height);
+	if (!_ansr_arena_fits(_ansr, size)) {
+		new_height = height;
+		size = GRID_SIZE(new_height);
+		if (!_ansr_arena_fits(_ansr, size))
+			return -ENOSPC;
+	}
+#undef GRID_SIZE
+
+	block = _ansr_arena_alloc(_ansr->arena, size, _ansr_max_slab(_ansr));
+	if (!block)
+		return -ENOMEM;
+
+	/* the block gets carved up, so it mustn't be grown in place as the arena's last allocation */
+	_ansr->arena->last = NULL;
+	_ansr->arena_bytes += ALIGN(size, ANSR_ARENA_ALIGN);
+	if (old_height)
+		_ansr->n_reallocs++;
+
+	rows = (ansr_row_t **)block;
+	headers = (ansr_row_t *)(block + ALIGN(new_height * sizeof(*rows), ANSR_ARENA_ALIGN));
+	disp_states = (uint16_t *)((char *)headers + ALIGN(new_height * sizeof(*headers), ANSR_ARENA_ALIGN));
+	codes = (char *)disp_states + ALIGN(new_height * stride * sizeof(*disp_states), ANSR_ARENA_ALIGN);
+
+	if (old_height) {
+		memcpy(disp_states, ansr->grid_disp_states, old_height * stride * sizeof(*disp_states));
+		memcpy(codes, ansr->grid_codes, old_height * stride);
+	}
+	memset(&disp_states[old_height * stride], 0, (new_height - old_height) * stride * sizeof(*disp_states));
+	memset(&codes[old_height * stride], 0, (new_height - old_height) * stride);
+
+	for (size_t y = 0; y < new_height; y++) {
+		headers[y] = (ansr_row_t){
+			.width = y < old_height ? ansr->rows[y]->width : 0,
+			.allocated_width = stride,
+			.refs = 1,
+			.codes = &codes[y * stride],
+			.disp_states = &disp_states[y * stride],
+		};
+		rows[y] = &headers[y];
+	}
+
+	ansr->rows = rows;
+	ansr->allocated_height = new_height;
+	ansr->grid_codes = codes;
+	ansr->grid_disp_states = disp_states;
+
+	return 0;
+}
+
+
+/* allocate the rows array and rows of width cols for the first height rows in one block,
+ * so a canvas of known extent is laid out contiguously without any growing.
+ * rows already as wide are kept, narrower ones get moved into the block.
+ * it's only a hint, nothing is done when the block doesn't fit conf.max_bytes.
+ * returns -errno on failure (ENOMEM)
+ */
+static int _ansr_presize(_ansr_t *_ansr, unsigned width, unsigned height)
+{
+	ansr_t	*ansr = &_ansr->public;
+	size_t	row_size, size = 0;
+	char	*block;
+
+	if (ansr->stride) {
+		int	r;
+
+		r = _ansr_grid_reserve(_ansr, MIN(height, _ansr_max_rows(_ansr)));
+
+		return r == -ENOSPC ? 0 : r;
+	}
+
+	if (_ansr_sparse(_ansr)) /* only the rows array, the runs are sized as they're written */
+		width = 0;
+
+	width = MIN(width, _ansr_max_cols(_ansr));
+	height = MIN(height, _ansr_max_rows(_ansr));
+	row_size = ALIGN(_ansr_row_size(width), ANSR_ARENA_ALIGN);
+
+	if (height > ansr->allocated_height)
+		size += ALIGN(height * sizeof(*ansr->rows), ANSR_ARENA_ALIGN);
+
+	for (unsigned y = 0; width && y < height; y++) {
+		if (y >= ansr->allocated_height || !ansr->rows[y] || ansr->rows[y]->allocated_width < width)
+			size += row_size;
+	}
+
+	if (!size || !_ansr_arena_fits(_ansr, size))
+		return 0;
+
+	block = _ansr_arena_alloc(_ansr->arena, size, _ansr_max_slab(_ansr));
+	if (!block)
+		return -ENOMEM;
+
+	/* the block gets carved up, so it mustn't be grown in place as the arena's last allocation */
+	_ansr->arena->last = NULL;
+	_ansr->arena_bytes += size;
+
+	if (height > ansr->allocated_height) {
+		ansr_row_t	**rows = (ansr_row_t **)block;
+
+		if (ansr->allocated_height)
+			memcpy(rows, ansr->rows, ansr->allocated_height * sizeof(*rows));
+		memset(&rows[ansr->allocated_height], 0, (height - ansr->allocated_height) * sizeof(*rows));
+		ansr->rows = rows;
+		ansr->allocated_height = height;
+		block += ALIGN(height * sizeof(*rows), ANSR_ARENA_ALIGN);
+	}
+
+	for (unsigned y = 0; width && y < height; y++) {
+		ansr_row_t	*row = ansr->rows[y], *new;
+
+		if (row && row->allocated_width >= width)
+			continue;
+
+		new = (ansr_row_t *)block;
+		block += row_size;
+
+		*new = (ansr_row_t){
+			.allocated_width = width,
+			.refs = 1,
+			.disp_states = (uint16_t *)&new[1],
+		};
+		new->codes = (char *)&new->disp_states[width];
+		memset(new->disp_states, 0, width * (sizeof(uint16_t) + sizeof(char)));
+		if (row) {
+			memcpy(new->disp_states, row->disp_states, row->width * sizeof(*row->disp_states));
+			memcpy(new->codes, row->codes, row->width);
+			new->width = row->width;
+		}
+		ansr->rows[y] = new;
+	}
+
+	return 0;
+}
+
+
+/* create a new ansi renderer of width,height dimensions, starts completely cleared.
+ * if input is non-NULL it will be applied to the newly created ans.
+ */
+ansr_t * ansr_new(ansr_conf_t *conf, char *input, size_t input_len)
+{
+	_ansr_t	*_ansr;
+
+	assert(!input || input_len > 0);
+
+	if (!conf)
+		conf = &ansr_conf_defaults;
+
+	assert(!conf->allocator.malloc == !conf->allocator.free);
+
+	_ansr = _ansr_calloc(&conf->allocator, sizeof(*_ansr));
+	if (!_ansr)
+		return NULL;
+
+	_ansr->public.conf = *conf;
+
+	_ansr->arena = conf->arena;
+	if (!_ansr->arena) {
+		_ansr->arena = ansr_arena_new(&conf->allocator, 0);
+		if (!_ansr->arena)
+			return ansr_free(&_ansr->public);
+
+		_ansr->own_arena = 1;
+	}
+
+	/* handle 0 is the zeroed disp_state untouched cells have, there are none in event mode */
+	if (!conf->events.span && _ansr_disp_intern(_ansr, &_ansr->disp_state) < 0)
+		return ansr_free(&_ansr->public);
+
+	if (!conf->events.span) {
+		unsigned	width = conf->expected_width, height = conf->expected_height;
+
+		if (conf->measure && input && ansr_measure(conf, input, input_len, &width, &height) < 0)
+			return ansr_free(&_ansr->public);
+
+		_ansr->public.stride = _ansr_stride(conf, width);
+		if (_ansr_presize(_ansr, width, height) < 0)
+			return ansr_free(&_ansr->public);
+	}
+
+	if (input && ansr_write(&_ansr->public, input, input_len) < 0)
+		return ansr_free(&_ansr->public);
+
+	return &_ansr->public;
+}
+
+
+/* reset ansr to the state of a newly created one using conf, for parsing another input.
+ * the allocated rows are kept and reused with a private arena, unless conf
+ * changes the layout (stride or sparse), which resets the arena.  nothing is
+ * kept from a caller-supplied conf->arena, which may then be reset before
+ * ansr is written to again, its storage is allocated anew by ansr_write().
+ * conf->allocator must be the one ansr was created with.
+ * returns -errno on failure (EINVAL, ENOMEM), after ENOMEM ansr is unusable and must be freed.
+ */
+int ansr_reset(ansr_t *ansr, ansr_conf_t *conf)
+{
+	_ansr_t	*_ansr = (_ansr_t *)ansr;
+	int	relayout, r;
+
+	assert(ansr);
+
+	if (!conf)
+		conf = &ansr_conf_defaults;
+
+	if (memcmp(&conf->allocator, &ansr->conf.allocator, sizeof(conf->allocator)))
+		return -EINVAL;
+
+	relayout = _ansr_stride(conf, conf->expected_width) != ansr->stride || conf->sparse != ansr->conf.sparse;
+
+	if (conf->arena != ansr->conf.arena) {
+		if (_ansr->own_arena)
+			ansr_arena_free(_ansr->arena);
+
+		_ansr->arena = conf->arena;
+		_ansr->own_arena = 0;
+		if (!_ansr->arena) {
+			_ansr->arena = ansr_arena_new(&conf->allocator, 0);
+			if (!_ansr->arena)
+				return -ENOMEM;
+
+			_ansr->own_arena = 1;
+		}
+	}
+
+	if (!_ansr->own_arena || conf->arena != ansr->conf.arena || relayout) {
+		/* everything allocated belongs to an arena we can't keep using,
+		 * either the old one, or the caller's which may get reset under us.
+		 * our own is just reset when its rows don't fit the new layout.
+		 */
+		if (_ansr->own_arena)
+			ansr_arena_reset(_ansr->arena);
+
+		ansr->rows = NULL;
+		ansr->allocated_height = 0;
+		ansr->height = 0;
+		ansr->grid_codes = NULL;
+		ansr->grid_disp_states = NULL;
+		_ansr->spare_rows = NULL;
+		_ansr->n_spare_rows = _ansr->n_spare_rows_allocated = 0;
+		_ansr->event_widths = NULL;
+		_ansr->n_event_widths = 0;
+		_ansr->arena_bytes = 0;
+	}
+
+	if (_ansr->event_widths)
+		memset(_ansr->event_widths, 0, _ansr->n_event_widths * sizeof(*_ansr->event_widths));
+
+	for (unsigned y = 0; y < ansr->height; y++) {
+		ansr_row_t	*row = ansr->rows[y];
+
+		if (!row)
+			continue;
+
+		if (row->refs > 1) { /* shared, the last one to go clears it */
+			row->refs--;
+			ansr->rows[y] = NULL;
+			continue;
+		}
+
+		if (_ansr_sparse(_ansr)) {
+			for (unsigned i = 0; i < row->n_runs; i++) {
+				ansr_row_t	*cells = row->runs[i].cells;
+
+				memset(cells->codes, 0, cells->width);
+				memset(cells->disp_states, 0, cells->width * sizeof(*cells->disp_states));
+				cells->width = 0;
+			}
+			row->n_runs = 0;
+		} else {
+			memset(row->codes, 0, row->width);
+			memset(row->disp_states, 0, row->width * sizeof(*row->disp_states));
+		}
+		row->width = 0;
+	}
+
+	ansr->stride = _ansr_stride(conf, conf->expected_width);
+	ansr->conf = *conf;
+	ansr->height = 0;
+	_ansr->state = ANSR_STATE_INPUT;
+	_ansr->cursor_x = _ansr->cursor_y = 0;
+	_ansr->n_params = 0;
+	_ansr->accumulator = 0;
+	_ansr->n_reallocs = 0;
+	_ansr->n_clipped = 0;
+	_ansr->n_rows_shared = 0;
+	_ansr->bytes_shared = 0;
+	_ansr->unsupported = (ansr_unsupported_t){};
+	_ansr->n_sgr_cache_hits = _ansr->n_sgr_cache_misses = 0;	/* sgr_cache itself stays valid */
+
+	/* only the zeroed disp_state at handle 0 is kept */
+	ansr->n_disp_states = 0;
+	if (_ansr->disp_buckets)	/* event mode instances never hash disp_states */
+		memset(_ansr->disp_buckets, 0, _ansr->n_disp_buckets * sizeof(*_ansr->disp_buckets));
+	_ansr->disp_state = (ansr_disp_state_t){};
+	_ansr->disp_handle = 0;
+	_ansr->disp_dirty = 0;
+
+	if (conf->events.span)
+		return 0;
+
+	/* don't allocate from the caller's arena before they may reset it */
+	if (_ansr->own_arena) {
+		r = _ansr_presize(_ansr, conf->expected_width, conf->expected_height);
+		if (r < 0)
+			return r;
+	} else {
+		_ansr->presize_pending = 1;
+	}
+
+	return _ansr_disp_intern(_ansr, &_ansr->disp_state);
+}
+
+
+/* params past ANSR_MAX_PARAMS or over 16 bits are dropped, making the sequence malformed */
+static inline void _ansr_params_append_accumulator(_ansr_t *_ansr)
+{
+	if (_ansr->accumulator > UINT16_MAX || _ansr->n_params == ANSR_MAX_PARAMS)
+		_ansr->csi_malformed = 1;
+	else
+		_ansr->params[_ansr->n_params++] = _ansr->accumulator;
+
+	_ansr->accumulator = 0;
+}
+
+
+/* returns CSI parameter i, or def when it's omitted or 0 */
+static inline unsigned _ansr_param(_ansr_t *_ansr, size_t i, unsigned def)
+{
+	if (i >= _ansr->n_params || !_ansr->params[i])
+		return def;
+
+	return _ansr->params[i];
+}
+
+
+/* count an unsupported bit of input being skipped in counter */
+/* returns -ENOTSUP in conf.strict, 0 otherwise */
+static inline int _ansr_unsupported(_ansr_t *_ansr, unsigned *counter)
+{
+	(*counter)++;
+
+	return _ansr->public.conf.strict ? -ENOTSUP : 0;
+}
+
+
+static inline void _ansr_sgr_reset(ansr_disp_state_t *disp_state)
+{
+	*disp_state = (ansr_disp_state_t){ .colors = { .fg = ANSR_COLOR_WHITE } };
+}
+
+
+/* count SGR param p as skipped, in unsupported when non-NULL */
+/* returns 1, or -ENOTSUP in conf.strict */
+static inline int _ansr_sgr_skip(_ansr_t *_ansr, ansr_unsupported_t *unsupported, unsigned p)
+{
+	int	r;
+
+	if (!unsupported)
+		return 1;
+
+	if (p < ANSR_ARRAY_SIZE(unsupported->sgr))
+		r = _ansr_unsupported(_ansr, &unsupported->sgr[p]);
+	else
+		r = _ansr_unsupported(_ansr, &unsupported->sgr_other);
+
+	return r < 0 ? r : 1;
+}
+
+
+/* apply the collected SGR params to disp_state, counting skipped ones in unsupported when non-NULL */
+/* returns the number of params skipped, or -errno on failure (ENOTSUP in conf.strict) */
+static int _ansr_sgr_apply(_ansr_t *_ansr, ansr_disp_state_t *disp_state, ansr_unsupported_t *unsupported)
+{
+	int	skipped = 0;
+
+	for (size_t i = 0; i < _ansr->n_params; i++) {
+		unsigned	p = _ansr->params[i];
+		int		r = 0;
+
+		switch (p) {
+		case 0: /* reset */
+			_ansr_sgr_reset(disp_state);
+			break;
+
+		case 1: /* Bold or increased intensity */
+			disp_state->attrs.bold = 1;
+			break;
+
+		case 2: /* Faint, decreased intensity, or dim */
+			disp_state->attrs.faint = 1;
+			break;
+
+		case 3: /* Italic */
+			disp_state->attrs.italic = 1;
+			break;
+
+		case 4: /* Underline */
+			disp_state->attrs.underline = 1;
+			break;
+
+		case 5: /* Slow blink (< 150 times per minute) */
+			disp_state->attrs.slow_blink = 1;
+			break;
+
+		case 6: /* rapid blink (>= 150 per minute) */
+			disp_state->attrs.rapid_blink = 1;
+			break;
+
+		case 7: /* reverse/invert video */
+			disp_state->attrs.invert = 1;
+			break;
+
+		case 8: /* conceal or hide */
+			disp_state->attrs.conceal = 1;
+			break;
+
+		case 9: /* strikeout */
+			disp_state->attrs.strikeout = 1;
+			break;
+
+		case 10: /* primary (default) font */
+		case 11 ... 19: /* alternative font 1-9 */
+		case 20: /* Fraktur (gothic) */
+			r = _ansr_sgr_skip(_ansr, unsupported, p);
+			break;
+
+		case 21: /* doubly underlined; or: not bold */
+			disp_state->attrs.double_underline = 1;
+			break;
+
+		case 22: /* normal intensity */
+			disp_state->attrs.bold = 0;
+			break;
+
+		case 23: /* neither italic, nor blackletter */
+			disp_state->attrs.italic = 0;
+			break;
+
+		case 24: /* Not underlined, neither singly nor doubly underlined */
+			disp_state->attrs.underline =
+			disp_state->attrs.double_underline = 0;
+			break;
+
+		case 25: /* not blinking (turn blinking off) */
+			disp_state->attrs.slow_blink =
+			disp_state->attrs.rapid_blink = 0;
+			break;
+
+		case 26: /* proportional spacing */
+			disp_state->attrs.proportional = 1;
+			break;
+
+		case 27: /* Not reversed */
+			disp_state->attrs.invert = 0;
+			break;
+
+		case 28: /* reveal; not concealed */
+			disp_state->attrs.conceal = 0;
+			break;
+
+		case 29: /* not crossed out */
+			disp_state->attrs.strikeout = 0;
+			break;
+
+		case 30 ... 37: /* set foreground color */
+			disp_state->colors.fg = p - 30;
+			break;
+
+		case 38: /* RGB set foreground color - Next arguments are 5;n or 2;r;g;b XXX ???? */
+		case 48: /* RGB set background color - Next arguments are 5;n or 2;r;g;b  */
+		case 58: /* Set underline color 	Not in standard; implemented in Kitty, VTE, mintty, and iTerm2.[40][41] Next arguments are 5;n or 2;r;g;b. */
+			/* only the 16 colors of the 256 color table we have can be used, the rest is skipped */
+			if (i + 2 < _ansr->n_params && _ansr->params[i + 1] == 5) {
+				unsigned	n = _ansr->params[i + 2];
+
+				i += 2;
+				if (p == 38 && n <= ANSR_COLOR_BRIGHT_WHITE)
+					disp_state->colors.fg = n;
+				else if (p == 48 && n <= ANSR_COLOR_BRIGHT_WHITE)
+					disp_state->colors.bg = n;
+				else
+					r = _ansr_sgr_skip(_ansr, unsupported, p);
+			} else {
+				if (i + 4 < _ansr->n_params && _ansr->params[i + 1] == 2)
+					i += 4;
+				else	/* no telling where this ends, skip the rest */
+					i = _ansr->n_params;
+
+				r = _ansr_sgr_skip(_ansr, unsupported, p);
+			}
+/*
+ESC[38;5;⟨n⟩m Select foreground color      where n is a number from the table below
+ESC[48;5;⟨n⟩m Select background color
+  0-  7:  standard colors (as in ESC [ 30–37 m)
+  8- 15:  high intensity colors (as in ESC [ 90–97 m)
+ 16-231:  6 × 6 × 6 cube (216 colors): 16 + 36 × r + 6 × g + b (0 ≤ r, g, b ≤ 5)
+232-255:  grayscale from dark to light in 24 steps
+*/
+			break;
+
+		case 39: /* default foreground color - implementation defined */
+			disp_state->colors.fg = ANSR_COLOR_WHITE;
+			break;
+
+		case 40 ... 47: /* set background color */
+			disp_state->colors.bg = p - 40;
+			break;
+
+		case 49: /* Default background color - implementatoin defined */
+			disp_state->colors.bg = ANSR_COLOR_BLACK;
+			break;
+
+		case 50: /* disable proportional spacing */
+			disp_state->attrs.proportional = 0;
+			break;
+
+		case 51: /* Framed - "emoji variation selector" in mintty apparently */
+			disp_state->attrs.framed = 1;
+			break;
+
+		case 52: /* encircled */
+			disp_state->attrs.encircled = 1;
+			break;
+
+		case 53: /* Overlined 	Not supported in Terminal.app */
+			disp_state->attrs.overlined = 1;
+			break;
+
+		case 54: /* Neither framed nor encircled 	 */
+			disp_state->attrs.framed =
+			disp_state->attrs.encircled = 0;
+			break;
+
+		case 55: /* Not overlined 	 */
+			disp_state->attrs.overlined = 0;
+			break;
+
+		case 59: /* Default underline color 	Not in standard; implemented in Kitty, VTE, mintty, and iTerm2.[40][41] */
+			r = _ansr_sgr_skip(_ansr, unsupported, p);
+			break;
+
+		case 60: /* Ideogram underline or right side line 	Rarely supported */
+			disp_state->attrs.ideogram_underline = 1;
+			break;
+
+		case 61: /* Ideogram double underline, or double line on the right side */
+			disp_state->attrs.ideogram_double_underline = 1;
+			break;
+
+		case 62: /* Ideogram overline or left side line */
+			disp_state->attrs.ideogram_overline = 1;
+			break;
+
+		case 63: /* Ideogram double overline, or double line on the left side */
+			disp_state->attrs.ideogram_double_overline = 1;
+			break;
+
+		case 64: /* Ideogram stress marking */
+			disp_state->attrs.ideogram_stress = 1;
+			break;
+
+		case 65: /* No ideogram attributes 	Reset the effects of all of 60–64 */
+			disp_state->attrs.ideogram_underline =
+			disp_state->attrs.ideogram_double_underline =
+			disp_state->attrs.ideogram_overline =
+			disp_state->attrs.ideogram_double_overline =
+			disp_state->attrs.ideogram_stress = 0;
+			break;
+
+		case 73: /* Superscript 	Implemented only in mintty[44] */
+			disp_state->attrs.superscript = 1;
+			break;
+
+		case 74: /* Subscript */
+			disp_state->attrs.subscript = 1;
+			break;
+
+		case 75: /* Neither superscript nor subscript */
+			disp_state->attrs.superscript =
+			disp_state->attrs.subscript = 0;
+			break;
+
+		case 90 ... 97: /* Set bright foreground color 	Not in standard; originally implemented by aixterm[29] */
+			/* why is this distinguished from just setting the fg/bg colors and the bold intesnsity attribute? */
+			disp_state->colors.fg = ANSR_COLOR_BRIGHT_BLACK + p - 90;
+			break;
+
+		case 100 ... 107: /* Set bright background color  */
+			disp_state->colors.bg = ANSR_COLOR_BRIGHT_BLACK + p - 100;
+			break;
+
+		default:
+			r = _ansr_sgr_skip(_ansr, unsupported, p);
+			break;
+		}
+
+		if (r < 0)
+			return r;
+
+		skipped += r;
+	}
+
+	return skipped;
+}
+
+
+static inline size_t _ansr_sgr_hash(const uint16_t *params, size_t n_params)
+{
+	uint32_t	h = n_params;
+
+	for (size_t i = 0; i < n_params; i++)
+		h = h * 31 + params[i];
+
+	return _ansr_disp_hash(h);
+}
+
+
+/* art tends to repeat the same few SGR sequences over and over, so their
+ * effects are cached by params in sgr_cache, making a repeat one lookup.
+ * returns -errno on failure (ENOTSUP in conf.strict)
+ */
+static int _ansr_sgr(_ansr_t *_ansr)
+{
+	ansr_sgr_cache_t	*cache;
+	ansr_disp_state_t	probe;
+	uint32_t		words[ANSR_DISP_WORDS], probed[ANSR_DISP_WORDS];
+	int			r;
+
+	if (!_ansr->n_params) { /* SGR with zero params is assumed to be a reset; SGR 0 */
+		_ansr_sgr_reset(&_ansr->disp_state);
+		return 0;
+	}
+
+	if (_ansr->n_params > ANSR_SGR_CACHE_PARAMS) {
+		r = _ansr_sgr_apply(_ansr, &_ansr->disp_state, &_ansr->unsupported);
+
+		return r < 0 ? r : 0;
+	}
+
+	cache = &_ansr->sgr_cache[_ansr_sgr_hash(_ansr->params, _ansr->n_params) & (ANSR_SGR_CACHE_SIZE - 1)];
+	if (cache->n_params == _ansr->n_params && !memcmp(cache->params, _ansr->params, _ansr->n_params * sizeof(*_ansr->params))) {
+		memcpy(words, &_ansr->disp_state, sizeof(words));
+		for (unsigned i = 0; i < ANSR_DISP_WORDS; i++)
+			words[i] = (words[i] & ~cache->mask[i]) | cache->value[i];
+		memcpy(&_ansr->disp_state, words, sizeof(words));
+		_ansr->n_sgr_cache_hits++;
+
+		return 0;
+	}
+
+	_ansr->n_sgr_cache_misses++;
+	memcpy(words, &_ansr->disp_state, sizeof(words));
+	for (unsigned i = 0; i < ANSR_DISP_WORDS; i++)
+		words[i] = ~words[i];
+	memcpy(&probe, words, sizeof(words));
+
+	r = _ansr_sgr_apply(_ansr, &_ansr->disp_state, &_ansr->unsupported);
+	if (r) /* sequences skipping params aren't cached, they need counting every time */
+		return r < 0 ? r : 0;
+
+	/* SGR params only ever assign fields, so applying them to the complement
+	 * of disp_state too reveals the assigned bits as those that now agree.
+	 */
+	(void) _ansr_sgr_apply(_ansr, &probe, NULL);
+	memcpy(words, &_ansr->disp_state, sizeof(words));
+	memcpy(probed, &probe, sizeof(probed));
+
+	cache->n_params = _ansr->n_params;
+	memcpy(cache->params, _ansr->params, _ansr->n_params * sizeof(*_ansr->params));
+	for (unsigned i = 0; i < ANSR_DISP_WORDS; i++) {
+		cache->mask[i] = ~(words[i] ^ probed[i]);
+		cache->value[i] = words[i] & cache->mask[i];
+	}
+
+	return 0;
+}
+
+
+/* is c a byte ANSR_STATE_INPUT needs to act on rather than place on the canvas? */
+static inline int _ansr_is_ctrl(unsigned char c)
+{
+	return (c >= 0x07 && c <= 0x0d) || c == 0x1a || c == 0x1b || c == 0x7f;
+}
+
+
+/* returns the length of the leading run of s[0..len) free of _ansr_is_ctrl() bytes,
+ * i.e. the text that can go straight onto the canvas.
+ */
+static size_t _ansr_scan_text(const char *s, size_t len)
+{
+	size_t	i = 0;
+
+#if defined(__AVX2__)
+	for (; i + 32 <= len; i += 32) {
+		__m256i		v = _mm256_loadu_si256((const __m256i *)&s[i]);
+		__m256i		m;
+		unsigned	mask;
+
+		/* 0x07-0x0d: (v - 7) <= 6 unsigned */
+		m = _mm256_cmpeq_epi8(_mm256_subs_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(0x07)), _mm256_set1_epi8(6)), _mm256_setzero_si256());
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x1a)));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x1b)));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+
+		mask = _mm256_movemask_epi8(m);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+#if defined(__SSE2__)
+	for (; i + 16 <= len; i += 16) {
+		__m128i		v = _mm_loadu_si128((const __m128i *)&s[i]);
+		__m128i		m;
+		unsigned	mask;
+
+		m = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(v, _mm_set1_epi8(0x07)), _mm_set1_epi8(6)), _mm_setzero_si128());
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x1a)));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x1b)));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+
+		mask = _mm_movemask_epi8(m);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+	for (; i < len; i++) {
+		if (_ansr_is_ctrl(s[i]))
+			break;
+	}
+
+	return i;
+}
+
+
+/* make room in *row_ptr for width cols, allocating it when NULL with at least min_width */
+/* returns -errno on failure (ENOMEM, ENOSPC when conf.max_bytes would be exceeded) */
+static int _ansr_row_reserve(_ansr_t *_ansr, ansr_row_t **row_ptr, unsigned width, unsigned min_width)
+{
+	if (!*row_ptr || width > (*row_ptr)->allocated_width) { /* expand cols */
+		size_t		old_width = *row_ptr ? (*row_ptr)->allocated_width : 0;
+		size_t		new_width = MAX(old_width * 2, min_width);
+		ansr_row_t	*new;
+
+		new_width = MAX(new_width, width);
+		new_width = MIN(new_width, _ansr_max_cols(_ansr));
+		if (!_ansr_arena_fits(_ansr, _ansr_row_size(new_width))) {
+			new_width = width;
+			if (!_ansr_arena_fits(_ansr, _ansr_row_size(new_width)))
+				return -ENOSPC;
+		}
+
+		new = _ansr_grow(_ansr, *row_ptr, old_width ? _ansr_row_size(old_width) : 0, _ansr_row_size(new_width));
+		if (!new)
+			return -ENOMEM;
+
+		/* disp_states immediately follow the row, so only codes move */
+		new->disp_states = (uint16_t *)&new[1];
+		new->codes = (char *)&new->disp_states[new_width];
+		memmove(new->codes, &new->disp_states[old_width], old_width);
+		memset(&new->disp_states[old_width], 0, (new_width - old_width) * sizeof(*new->disp_states));
+		memset(&new->codes[old_width], 0, new_width - old_width);
+		if (!*row_ptr) {
+			new->width = 0;
+			new->refs = 1;
+			new->n_runs = new->allocated_runs = 0;
+			new->runs = NULL;
+		}
+		new->allocated_width = new_width;
+		*row_ptr = new;
+	}
+
+	return 0;
+}
+
+
+/* give row y a copy of the cells it shares after ansr_dedup() to write to, with room for width cols */
+/* returns -errno on failure (ENOMEM, ENOSPC) */
+static int _ansr_row_unshare(_ansr_t *_ansr, unsigned y, unsigned width)
+{
+	ansr_row_t	*shared = _ansr->public.rows[y], *row = NULL;
+	int		r;
+
+	if (_ansr->n_spare_rows)
+		row = _ansr->spare_rows[--_ansr->n_spare_rows];
+
+	r = _ansr_row_reserve(_ansr, &row, MAX(width, shared->width), ANSR_MIN_ALLOC_COLS);
+	if (r < 0) {
+		if (row)
+			_ansr->n_spare_rows++;
+
+		return r;
+	}
+
+	memcpy(row->codes, shared->codes, shared->width);
+	memcpy(row->disp_states, shared->disp_states, shared->width * sizeof(*shared->disp_states));
+	row->width = shared->width;
+
+	shared->refs--;
+	_ansr->n_rows_shared--;
+	_ansr->bytes_shared -= _ansr_row_size(shared->allocated_width);
+	_ansr->public.rows[y] = row;
+
+	return 0;
+}
+
+
+/* make room in _ansr for row y to hold width cols */
+/* y and width must be within _ansr_max_rows() and _ansr_max_cols() */
+/* returns -errno on failure (ENOMEM, ENOSPC when conf.max_bytes would be exceeded) */
+static int _ansr_reserve(_ansr_t *_ansr, unsigned y, unsigned width)
+{
+	if (_ansr->public.stride) /* spans are already clipped to the stride */
+		return _ansr_grid_reserve(_ansr, (size_t)y + 1);
+
+	if (y >= _ansr->public.allocated_height) { /* expand rows */
+		ansr_row_t	**new;
+		size_t		new_height = MAX(ANSR_MIN_ALLOC_ROWS, (size_t)_ansr->public.allocated_height * 2);
+
+		new_height = MAX(new_height, (size_t)y + 1);
+		new_height = MIN(new_height, _ansr_max_rows(_ansr));
+		if (!_ansr_arena_fits(_ansr, new_height * sizeof(ansr_row_t *))) {
+			new_height = (size_t)y + 1;
+			if (!_ansr_arena_fits(_ansr, new_height * sizeof(ansr_row_t *)))
+				return -ENOSPC;
+		}
+
+		new = _ansr_grow(_ansr, _ansr->public.rows, _ansr->public.allocated_height * sizeof(ansr_row_t *), new_height * sizeof(ansr_row_t *));
+		if (!new)
+			return -ENOMEM;
+
+		memset(&new[_ansr->public.allocated_height], 0, sizeof(*new) * (new_height - _ansr->public.allocated_height));
+		_ansr->public.allocated_height = new_height;
+		_ansr->public.rows = new;
+	}
+
+	if (_ansr_sparse(_ansr)) { /* just the header, the cells go in runs */
+		if (!_ansr->public.rows[y]) {
+			ansr_row_t	*new;
+
+			if (!_ansr_arena_fits(_ansr, sizeof(*new)))
+				return -ENOSPC;
+
+			new = _ansr_grow(_ansr, NULL, 0, sizeof(*new));
+			if (!new)
+				return -ENOMEM;
+
+			*new = (ansr_row_t){ .refs = 1 };
+			_ansr->public.rows[y] = new;
+		}
+
+		return 0;
+	}
+
+	if (_ansr->public.rows[y] && _ansr->public.rows[y]->refs > 1)
+		return _ansr_row_unshare(_ansr, y, width);
+
+	if (!_ansr->public.rows[y] && _ansr->n_spare_rows)
+		_ansr->public.rows[y] = _ansr->spare_rows[--_ansr->n_spare_rows];
+
+	return _ansr_row_reserve(_ansr, &_ansr->public.rows[y], width, ANSR_MIN_ALLOC_COLS);
+}
+
+
+/* make the runs of sparse row cover cols x through end, returning the run covering them in res_run.
+ * runs within ANSR_SPARSE_GAP cols of the span get merged with it, keeping the
+ * runs sorted and apart.  the storage of merged runs is kept past n_runs for reuse.
+ * returns -errno on failure (ENOMEM, ENOSPC)
+ */
+static int _ansr_runs_reserve(_ansr_t *_ansr, ansr_row_t *row, unsigned x, unsigned end, ansr_run_t **res_run)
+{
+	ansr_run_t	*runs, *run;
+	unsigned	i, j, start;
+	int		r;
+
+	for (i = 0; i < row->n_runs && (size_t)row->runs[i].x + row->runs[i].cells->width + ANSR_SPARSE_GAP < x; i++);
+	for (j = i; j < row->n_runs && row->runs[j].x <= (size_t)end + ANSR_SPARSE_GAP; j++);
+
+	if (i == j) { /* nothing near, insert a new run */
+		ansr_row_t	*spare;
+
+		if (row->n_runs == row->allocated_runs) {
+			unsigned	new_runs = MAX(ANSR_MIN_ALLOC_RUNS, row->allocated_runs * 2);
+
+			if (!_ansr_arena_fits(_ansr, new_runs * sizeof(*runs)))
+				return -ENOSPC;
+
+			runs = _ansr_grow(_ansr, row->runs, row->allocated_runs * sizeof(*runs), new_runs * sizeof(*runs));
+			if (!runs)
+				return -ENOMEM;
+
+			memset(&runs[row->allocated_runs], 0, (new_runs - row->allocated_runs) * sizeof(*runs));
+			row->runs = runs;
+			row->allocated_runs = new_runs;
+		}
+
+		spare = row->runs[row->n_runs].cells;
+		memmove(&row->runs[i + 1], &row->runs[i], (row->n_runs - i) * sizeof(*row->runs));
+		row->runs[i] = (ansr_run_t){ .x = x, .cells = spare };
+		row->n_runs++;
+		j = i + 1;
+	}
+
+	runs = row->runs;
+	run = &runs[i];
+	start = MIN(x, run->x);
+	if (runs[j - 1].cells)
+		end = MAX(end, runs[j - 1].x + runs[j - 1].cells->width);
+
+	r = _ansr_row_reserve(_ansr, &run->cells, end - start, ANSR_MIN_ALLOC_RUN_COLS);
+	if (r < 0)
+		return r;
+
+	if (start < run->x) { /* extending left, shift the cells over */
+		unsigned	shift = run->x - start;
+
+		memmove(&run->cells->codes[shift], run->cells->codes, run->cells->width);
+		memmove(&run->cells->disp_states[shift], run->cells->disp_states, run->cells->width * sizeof(*run->cells->disp_states));
+		memset(run->cells->codes, 0, MIN(shift, run->cells->width));
+		memset(run->cells->disp_states, 0, MIN(shift, run->cells->width) * sizeof(*run->cells->disp_states));
+		run->x = start;
+	}
+
+	for (unsigned k = i + 1; k < j; k++) { /* take over the cells of the merged runs, clearing them for reuse */
+		ansr_row_t	*cells = runs[k].cells;
+
+		memcpy(&run->cells->codes[runs[k].x - start], cells->codes, cells->width);
+		memcpy(&run->cells->disp_states[runs[k].x - start], cells->disp_states, cells->width * sizeof(*cells->disp_states));
+		memset(cells->codes, 0, cells->width);
+		memset(cells->disp_states, 0, cells->width * sizeof(*cells->disp_states));
+		cells->width = 0;
+	}
+
+	for (; j > i + 1; j--) { /* move the merged runs past n_runs */
+		ansr_run_t	merged = runs[i + 1];
+
+		memmove(&runs[i + 1], &runs[i + 2], (row->n_runs - i - 2) * sizeof(*runs));
+		runs[--row->n_runs] = merged;
+	}
+
+	run->cells->width = end - start;
+	*res_run = run;
+
+	return 0;
+}
+
+
+/* write a span of n cells in the current disp_state to row y starting at col x */
+/* extend the width row y would have in event mode to width, for erasing to its end */
+/* returns -errno on failure (ENOMEM, ENOSPC when conf.max_bytes would be exceeded) */
+static int _ansr_event_width(_ansr_t *_ansr, unsigned y, unsigned width)
+{
+	if (y >= _ansr->n_event_widths) {
+		unsigned	*new;
+		size_t		n = MAX(ANSR_MIN_ALLOC_ROWS, (size_t)_ansr->n_event_widths * 2);
+
+		n = MAX(n, (size_t)y + 1);
+		n = MIN(n, _ansr_max_rows(_ansr));
+		if (!_ansr_arena_fits(_ansr, n * sizeof(*new))) {
+			n = (size_t)y + 1;
+			if (!_ansr_arena_fits(_ansr, n * sizeof(*new)))
+				return -ENOSPC;
+		}
+
+		new = _ansr_grow(_ansr, _ansr->event_widths, _ansr->n_event_widths * sizeof(*new), n * sizeof(*new));
+		if (!new)
+			return -ENOMEM;
+
+		memset(&new[_ansr->n_event_widths], 0, sizeof(*new) * (n - _ansr->n_event_widths));
+		_ansr->n_event_widths = n;
+		_ansr->event_widths = new;
+	}
+
+	_ansr->event_widths[y] = MAX(_ansr->event_widths[y], width);
+
+	return 0;
+}
+
+
+/* codes come from text, or are all fill when text is NULL */
+/* no wrapping is performed, the row is expanded to fit the span */
+/* cells beyond conf.max_rows/max_cols are clipped */
+/* in event mode the span goes to conf.events.span instead */
+/* returns -errno on failure (ENOMEM, ENOSPC, or from conf.events.span) */
+static int _ansr_span(_ansr_t *_ansr, unsigned x, unsigned y, const char *text, char fill, size_t n)
+{
+	unsigned	max_cols = _ansr_max_cols(_ansr);
+	uint16_t	*disp_states;
+	char		*codes;
+	ansr_row_t	*row;
+	int		handle, r;
+
+	if (y >= _ansr_max_rows(_ansr) || x >= max_cols) {
+		_ansr->n_clipped += n;
+		return 0;
+	}
+
+	if (n > max_cols - x) {
+		_ansr->n_clipped += n - (max_cols - x);
+		n = max_cols - x;
+	}
+
+	if (!n)
+		return 0;
+
+	if (_ansr->measure) {
+		_ansr->measure->width = MAX(_ansr->measure->width, x + n);
+		_ansr->measure->height = MAX(_ansr->measure->height, y + 1);
+
+		return 0;
+	}
+
+	if (_ansr->public.conf.events.span) {
+		r = _ansr_event_width(_ansr, y, x + n);
+		if (r < 0)
+			return r;
+
+		return _ansr->public.conf.events.span(_ansr->public.conf.events.ctx, x, y, &_ansr->disp_state, text, fill, n);
+	}
+
+	handle = _ansr_disp_handle(_ansr);
+	if (handle < 0)
+		return handle;
+
+	r = _ansr_reserve(_ansr, y, x + n);
+	if (r < 0)
+		return r;
 
-	assert(!input || input_len > 0);
+	if (y >= _ansr->public.height)
+		_ansr->public.height = y + 1;
 
-	if (!conf)
-		conf = &ansr_conf_defaults;
+	row = _ansr->public.rows[y];
+	if (_ansr_sparse(_ansr)) {	/* sparse rows have no cells of their own, codes is NULL */
+		ansr_run_t	*run;
 
-	_ansr = calloc(1, sizeof(*_ansr));
-	if (!_ansr)
-		return NULL;
+		r = _ansr_runs_reserve(_ansr, row, x, x + n, &run);
+		if (r < 0)
+			return r;
 
-	_ansr->public.conf = *conf;
+		codes = &run->cells->codes[x - run->x];
+		disp_states = &run->cells->disp_states[x - run->x];
+	} else {
+		codes = &row->codes[x];
+		disp_states = &row->disp_states[x];
+	}
 
-	if (input && ansr_write(&_ansr->public, input, input_len) < 0)
-		return ansr_free(&_ansr->public);
+	if (text)
+		memcpy(codes, text, n);
+	else
+		memset(codes, fill, n);
 
-	return &_ansr->public;
+	for (size_t i = 0; i < n; i++)
+		disp_states[i] = handle;
+
+	if (row->width < x + n)
+		row->width = x + n;
+
+	return 0;
 }
 
 
-static int _ansr_params_append(_ansr_t *_ansr, char p)
+/* add the len chars of text to _ansr at current cursor position */
+/* wraps at conf.screen_width a whole span at a time */
+/* returns -errno on failure (ENOMEM) */
+static int _ansr_add_text(_ansr_t *_ansr, const char *text, size_t len)
 {
-	assert(_ansr);
+	unsigned	screen_width = _ansr->public.conf.screen_width;
 
-	if (_ansr->n_params + 1 > _ansr->n_params_allocated) {
-		char	*new;
-		size_t	newsize = MAX(ANSR_MIN_ALLOC_PARAMS, _ansr->n_params_allocated * 2);
+	while (len) {
+		size_t	n = len;
+		int	r;
 
-		new = realloc(_ansr->params, newsize);
-		if (!new)
-			return -ENOMEM;
+		if (screen_width && _ansr->cursor_x == screen_width) {
+			_ansr->cursor_x = 0;
+			_ansr->cursor_y++;
+		}
 
-		_ansr->n_params_allocated = newsize;
-		_ansr->params = new;
-	}
+		/* a cursor moved beyond screen_width never wraps, matching per-char behavior */
+		if (screen_width && _ansr->cursor_x < screen_width)
+			n = MIN(n, screen_width - _ansr->cursor_x);
 
-	_ansr->params[_ansr->n_params++] = p;
+		r = _ansr_span(_ansr, _ansr->cursor_x, _ansr->cursor_y, text, 0, n);
+		if (r < 0)
+			return r;
+
+		_ansr->cursor_x += n;
+		text += n;
+		len -= n;
+	}
 
 	return 0;
 }
 
 
-static int _ansr_params_append_accumulator(_ansr_t *_ansr)
+/* erase in line n at the cursor, cursor doesn't move */
+/* erased cells become spaces in the current disp_state */
+/* returns -errno on failure (ENOMEM) */
+static int _ansr_erase_line(_ansr_t *_ansr, unsigned n)
 {
-	int	r;
+	unsigned	start = 0, end = _ansr->public.conf.screen_width;
 
-	if (_ansr->accumulator > 0xff)
-		return -EOVERFLOW;
+	if (_ansr->cursor_y < _ansr->public.height && _ansr->public.rows[_ansr->cursor_y])
+		end = MAX(end, _ansr->public.rows[_ansr->cursor_y]->width);
+	else if (_ansr->cursor_y < _ansr->n_event_widths)
+		end = MAX(end, _ansr->event_widths[_ansr->cursor_y]);
 
-	r = _ansr_params_append(_ansr, _ansr->accumulator);
-	if (r < 0)
-		return r;
+	switch (n) {
+	case 0: /* cursor to end of line */
+		start = _ansr->cursor_x;
+		break;
 
-	_ansr->accumulator = 0;
+	case 1: /* beginning of line through cursor */
+		end = _ansr->cursor_x + 1;
+		break;
 
-	return 0;
-}
+	case 2: /* entire line */
+		break;
 
+	default:
+		return 0;
+	}
 
-static inline void _ansr_sgr_reset(_ansr_t *_ansr)
-{
-	_ansr->disp_state = (ansr_disp_state_t){ .colors = { .fg = ANSR_COLOR_WHITE } };
+	if (start >= end)
+		return 0;
+
+	return _ansr_span(_ansr, start, _ansr->cursor_y, NULL, ' ', end - start);
 }
 
 
-static inline void _ansr_sgr(_ansr_t *_ansr)
+/* advance the cursor n tab stops, they're every 8 columns up to the last column */
+static void _ansr_tab(_ansr_t *_ansr, unsigned n)
 {
-	if (!_ansr->n_params) /* SGR with zero params is assumed to be a reset; SGR 0 */
-		return _ansr_sgr_reset(_ansr);
+	unsigned	screen_width = _ansr->public.conf.screen_width;
+	uint64_t	x;
 
-	for (size_t i = 0; i < _ansr->n_params; i++) {
-		char	p = _ansr->params[i];
+	if (!n)
+		return;
 
-		switch (p) {
-		case 0: /* reset */
-			_ansr_sgr_reset(_ansr);
-			break;
+	/* straight to the nth stop, hostile input asks for up to 65535 of them */
+	x = ((uint64_t)_ansr->cursor_x | 7) + 1 + (uint64_t)(n - 1) * 8;
+	if (screen_width && _ansr->cursor_x < screen_width)
+		x = MIN(x, screen_width - 1);
+	else if (x > UINT_MAX) /* wrapped, stop at the last stop there is */
+		x = MAX(_ansr->cursor_x, UINT_MAX & ~7U);
 
-		case 1: /* Bold or increased intensity */
-			_ansr->disp_state.attrs.bold = 1;
-			break;
+	_ansr->cursor_x = x;
+}
 
-		case 2: /* Faint, decreased intensity, or dim */
-			_ansr->disp_state.attrs.faint = 1;
-			break;
 
-		case 3: /* Italic */
-			_ansr->disp_state.attrs.italic = 1;
-			break;
+/* act on the CSI sequence ending in final byte, with its params already collected */
+/* returns -errno on failure */
+static int _ansr_csi(_ansr_t *_ansr, char final)
+{
+	if (_ansr->csi_private)
+		return _ansr_unsupported(_ansr, &_ansr->unsupported.csi_private);
 
-		case 4: /* Underline */
-			_ansr->disp_state.attrs.underline = 1;
-			break;
+	if (_ansr->csi_malformed)
+		return _ansr_unsupported(_ansr, &_ansr->unsupported.malformed);
 
-		case 5: /* Slow blink (< 150 times per minute) */
-			_ansr->disp_state.attrs.slow_blink = 1;
-			break;
+	switch (final) {
+	/* 0x40 ... 0x6f:	final bytes */
+	case 0x41:		/* cursor up N bytes (default 1) */
+		_ansr->cursor_y -= MIN(_ansr->cursor_y, _ansr_param(_ansr, 0, 1));
+		break;
 
-		case 6: /* rapid blink (>= 150 per minute) */
-			_ansr->disp_state.attrs.rapid_blink = 1;
-			break;
+	case 0x42:		/* cursor down N bytes (default 1) */
+		_ansr->cursor_y += _ansr_param(_ansr, 0, 1);
+		break;
 
-		case 7: /* reverse/invert video */
-			_ansr->disp_state.attrs.invert = 1;
-			break;
+	case 0x43:		/* cursor forward N bytes (default 1) */
+		_ansr->cursor_x += _ansr_param(_ansr, 0, 1);
+		break;
 
-		case 8: /* conceal or hide */
-			_ansr->disp_state.attrs.conceal = 1;
-			break;
+	case 0x44:		/* cursor back N bytes (default 1) */
+		_ansr->cursor_x -= MIN(_ansr->cursor_x, _ansr_param(_ansr, 0, 1));
+		break;
 
-		case 9: /* strikeout */
-			_ansr->disp_state.attrs.strikeout = 1;
-			break;
+	case 0x45:		/* cursor start of next N line (default 1) */
+		_ansr->cursor_y += _ansr_param(_ansr, 0, 1);
+		_ansr->cursor_x = 0;
+		break;
 
-		case 10: /* primary (default) font */
-			assert(0);
-			break;
+	case 0x46:		/* cursor start of previous N line (default 1) */
+		_ansr->cursor_y -= MIN(_ansr->cursor_y, _ansr_param(_ansr, 0, 1));
+		_ansr->cursor_x = 0;
+		break;
 
-		case 11 ... 19: /* alternative font 1-9 */
-			assert(0);
-			break;
+	case 0x47:		/* cursor horiz absolute/column N (default 1) */
+		_ansr->cursor_x = _ansr_param(_ansr, 0, 1) - 1;
+		break;
 
-		case 20: /* Fraktur (gothic) */
-			assert(0);
-			break;
+	case 0x48:		/* cursor position row N col M (N;M) (defaults to 1 when omitted, 1-based coords) */
+	case 0x66:		/* horiz vert position - same as 0x48 */
+		_ansr->cursor_y = _ansr_param(_ansr, 0, 1) - 1;
+		_ansr->cursor_x = _ansr_param(_ansr, 1, 1) - 1;
+		break;
 
-		case 21: /* doubly underlined; or: not bold */
-			_ansr->disp_state.attrs.double_underline = 1;
-			break;
+	case 0x49:		/* cursor forward N tab stops (default 1) */
+		_ansr_tab(_ansr, _ansr_param(_ansr, 0, 1));
+		break;
 
-		case 22: /* normal intensity */
-			_ansr->disp_state.attrs.bold = 0;
-			break;
+	case 0x4a:		/* erase in display, if n is 0 or missing erase from cursor to end of screen.  if n is 1 from cursor to beginning of screen, 2 entire screen, 3 entire and scrollback */
+		/* TODO? we don't count this as unsupported because some ansis start with erase, but I'm not bothering with actually implementing it */
+		break;
 
-		case 23: /* neither italic, nor blackletter */
-			_ansr->disp_state.attrs.italic = 0;
-			break;
+	case 0x4b:		/* erase in line, n=0 or missing erase to end of line,  n=1 to beginning of line, n=2 entire line.  cursor pos doesn't change */
+		return _ansr_erase_line(_ansr, _ansr_param(_ansr, 0, 0));
 
-		case 24: /* Not underlined, neither singly nor doubly underlined */
-			_ansr->disp_state.attrs.underline =
-			_ansr->disp_state.attrs.double_underline = 0;
-			break;
+	case 0x6d: {		/* select graphic rendition n (SGR) */
+		int	r;
 
-		case 25: /* not blinking (turn blinking off) */
-			_ansr->disp_state.attrs.slow_blink =
-			_ansr->disp_state.attrs.rapid_blink = 0;
-			break;
+		r = _ansr_sgr(_ansr);
+		_ansr->disp_dirty = 1;
 
-		case 26: /* proportional spacing */
-			_ansr->disp_state.attrs.proportional = 0;
-			break;
+		return r;
+	}
 
-		case 27: /* Not reversed */
-			_ansr->disp_state.attrs.invert = 0;
-			break;
+	case 0x53:		/* scroll up */
+	case 0x54:		/* scroll down */
+	case 0x70 ... 0x7e:	/* "private" final bytes */
+	default:
+		return _ansr_unsupported(_ansr, &_ansr->unsupported.csi[final - 0x40]);
+	}
 
-		case 28: /* reveal; not concealed */
-			_ansr->disp_state.attrs.conceal = 0;
-			break;
+	return 0;
+}
 
-		case 29: /* not crossed out */
-			_ansr->disp_state.attrs.strikeout = 0;
-			break;
 
-		case 30 ... 37: /* set foreground color */
-			_ansr->disp_state.colors.fg = p - 30;
-			break;
+/* returns negative value on error */
+int ansr_write(ansr_t *ansr, char *input, size_t input_len)
+{
+	_ansr_t	*_ansr = (_ansr_t *)ansr;
 
-		case 38: /* RGB set foreground color - Next arguments are 5;n or 2;r;g;b XXX ???? */
-			assert(0); /* TODO */
-/*
-ESC[38;5;⟨n⟩m Select foreground color      where n is a number from the table below
-ESC[48;5;⟨n⟩m Select background color
-  0-  7:  standard colors (as in ESC [ 30–37 m)
-  8- 15:  high intensity colors (as in ESC [ 90–97 m)
- 16-231:  6 × 6 × 6 cube (216 colors): 16 + 36 × r + 6 × g + b (0 ≤ r, g, b ≤ 5)
-232-255:  grayscale from dark to light in 24 steps
-*/
-			break;
+	assert(ansr);
+	assert(input);
 
-		case 39: /* default foreground color - implementation defined */
-			assert(0); /* TODO */
-			break;
+	if (_ansr->presize_pending) {
+		int	r;
 
-		case 40 ... 47: /* set background color */
-			_ansr->disp_state.colors.bg = p - 40;
-			break;
+		r = _ansr_presize(_ansr, ansr->conf.expected_width, ansr->conf.expected_height);
+		if (r < 0)
+			return r;
 
-		case 48: /* RGB set background color - Next arguments are 5;n or 2;r;g;b  */
-			assert(0); /* TODO */
-			break;
+		_ansr->presize_pending = 0;
+	}
 
-		case 49: /* Default background color - implementatoin defined */
-			assert(0); /* TODO */
-			break;
+	for (size_t i = 0; i < input_len; i++) {
+		unsigned char	c = input[i];
+		int		r = 0;
 
-		case 50: /* disable proportional spacing */
-			_ansr->disp_state.attrs.proportional = 0;
-			break;
+		switch (_ansr_action(_ansr->state, c)) {
+		case ANSR_ACTION_TEXT: {
+			/* take everything up to the next control byte as one run */
+			size_t	n = 1 + _ansr_scan_text(&input[i + 1], input_len - i - 1);
 
-		case 51: /* Framed - "emoji variation selector" in mintty apparently */
-			_ansr->disp_state.attrs.framed = 1;
+			r = _ansr_add_text(_ansr, &input[i], n);
+			i += n - 1;
 			break;
+		}
 
-		case 52: /* encircled */
-			_ansr->disp_state.attrs.encircled = 1;
+		case ANSR_ACTION_IGNORE:
 			break;
 
-		case 53: /* Overlined 	Not supported in Terminal.app */
-			_ansr->disp_state.attrs.overlined = 1;
+		case ANSR_ACTION_BS:
+			if (_ansr->cursor_x > 0)
+				_ansr->cursor_x--;
 			break;
 
-		case 54: /* Neither framed nor encircled 	 */
-			_ansr->disp_state.attrs.framed =
-			_ansr->disp_state.attrs.encircled = 0;
+		case ANSR_ACTION_HT:
+			_ansr_tab(_ansr, 1);
 			break;
 
-		case 55: /* Not overlined 	 */
-			_ansr->disp_state.attrs.overlined = 0;
+		case ANSR_ACTION_LF:
+			/* TODO: scrolling? for now we just always expand rows/cols to fit rendering */
+			_ansr->cursor_y++;
 			break;
 
-		case 58: /* Set underline color 	Not in standard; implemented in Kitty, VTE, mintty, and iTerm2.[40][41] Next arguments are 5;n or 2;r;g;b. */
-			assert(0); /* TODO */
+		case ANSR_ACTION_CR:
+			_ansr->cursor_x = 0;
 			break;
 
-		case 59: /* Default underline color 	Not in standard; implemented in Kitty, VTE, mintty, and iTerm2.[40][41] */
-			assert(0); /* TODO */
+		case ANSR_ACTION_CONTROL:
+			/* XXX: FF; there isn't really a concept of a "page" when there's no screen dimensions */
+			r = _ansr_unsupported(_ansr, &_ansr->unsupported.controls);
 			break;
 
-		case 60: /* Ideogram underline or right side line 	Rarely supported */
-			_ansr->disp_state.attrs.ideogram_underline = 1;
-			break;
+		case ANSR_ACTION_SUB:
+			/* nothing more is looked at, here or in later writes */
+			_ansr->state = ANSR_STATE_EOF;
+			return 0;
 
-		case 61: /* Ideogram double underline, or double line on the right side */
-			_ansr->disp_state.attrs.ideogram_double_underline = 1;
+		case ANSR_ACTION_ESC:
+			_ansr->state = ANSR_STATE_ESCAPE;
 			break;
 
-		case 62: /* Ideogram overline or left side line */
-			_ansr->disp_state.attrs.ideogram_overline = 1;
+		case ANSR_ACTION_ESC_CSI:
+			_ansr->state = ANSR_STATE_CSI;
+			_ansr->accumulator = 0;
+			_ansr->n_params = 0;
+			_ansr->csi_private = 0;
+			_ansr->csi_malformed = 0;
 			break;
 
-		case 63: /* Ideogram double overline, or double line on the left side */
-			_ansr->disp_state.attrs.ideogram_double_overline = 1;
+		case ANSR_ACTION_ESC_FINAL:
+			_ansr->state = ANSR_STATE_INPUT;
+			r = _ansr_unsupported(_ansr, &_ansr->unsupported.escapes);
 			break;
 
-		case 64: /* Ideogram stress marking */
-			_ansr->disp_state.attrs.ideogram_stress = 1;
-			break;
+		case ANSR_ACTION_CSI_PARAM:
+			/* consume all the digits here, saturating as the value's only checked against UINT16_MAX */
+			for (;;) {
+				if (_ansr->accumulator <= UINT16_MAX) {
+					_ansr->accumulator *= 10;
+					_ansr->accumulator += c - 0x30;
+				}
 
-		case 65: /* No ideogram attributes 	Reset the effects of all of 60–64 */
-			_ansr->disp_state.attrs.ideogram_underline =
-			_ansr->disp_state.attrs.ideogram_double_underline =
-			_ansr->disp_state.attrs.ideogram_overline =
-			_ansr->disp_state.attrs.ideogram_double_overline =
-			_ansr->disp_state.attrs.ideogram_stress = 0;
-			break;
+				if (i + 1 == input_len || input[i + 1] < 0x30 || input[i + 1] > 0x39)
+					break;
 
-		case 73: /* Superscript 	Implemented only in mintty[44] */
-			_ansr->disp_state.attrs.superscript = 1;
+				c = input[++i];
+			}
 			break;
 
-		case 74: /* Subscript */
-			_ansr->disp_state.attrs.subscript = 1;
+		case ANSR_ACTION_CSI_SEP:
+			_ansr_params_append_accumulator(_ansr);
 			break;
 
-		case 75: /* Neither superscript nor subscript */
-			_ansr->disp_state.attrs.superscript =
-			_ansr->disp_state.attrs.subscript = 0;
+		case ANSR_ACTION_CSI_PRIVATE:
+			/* TODO: maybe never, the whole sequence gets skipped */
+			_ansr->csi_private = 1;
 			break;
 
-		case 90 ... 97: /* Set bright foreground color 	Not in standard; originally implemented by aixterm[29] */
-			/* why is this distinguished from just setting the fg/bg colors and the bold intesnsity attribute? */
-			assert(0); /* TODO */
+		case ANSR_ACTION_CSI_FINAL:
+			_ansr->state = ANSR_STATE_INPUT;
+
+			_ansr_params_append_accumulator(_ansr);
+			r = _ansr_csi(_ansr, c);
 			break;
 
-		case 100 ... 107: /* Set bright background color  */
-			assert(0); /* TODO */
+		case ANSR_ACTION_ABORT:
+			_ansr->state = ANSR_STATE_INPUT;
+			i--;
+			r = _ansr_unsupported(_ansr, &_ansr->unsupported.malformed);
 			break;
 		}
+
+		if (r < 0)
+			return r;
 	}
+
+	return 0;
 }
 
 
-/* add char c to _ansr at current cursor position */
-/* expands _ansr->rows/cols as needed */
-/* returns -errno on failure (ENOMEM) */
-static inline int _ansr_add_char(_ansr_t *_ansr, char c)
+/* measure the canvas input would produce with conf, without storing any cells.
+ * the extent is the width of the widest row and the height, as ansr_new() would leave them.
+ * with conf.grid that's before clipping to the stride, i.e. the stride holding all of it.
+ * returns -errno on failure (ENOMEM, ENOTSUP in conf.strict)
+ */
+int ansr_measure(ansr_conf_t *conf, char *input, size_t input_len, unsigned *res_width, unsigned *res_height)
 {
-	if (_ansr->public.conf.screen_width && _ansr->cursor_x == _ansr->public.conf.screen_width) {
-		_ansr->cursor_x = 0;
-		_ansr->cursor_y++;
-	}
+	ansr_measure_t	measure = {};
+	_ansr_t		*_ansr;
+	int		r;
 
-	/* XXX this is a quick and dirty hack implementation just to get things happening */
-
-	if (_ansr->cursor_y >= _ansr->public.allocated_height) { /* expand rows */
-		ansr_row_t	**new;
-		size_t		new_height = MAX(ANSR_MIN_ALLOC_ROWS, _ansr->public.allocated_height * 2);
+	assert(input);
+	assert(res_width);
+	assert(res_height);
 
-		new = realloc(_ansr->public.rows, new_height * sizeof(ansr_row_t *));
-		if (!new)
-			return -ENOMEM;
+	if (!conf)
+		conf = &ansr_conf_defaults;
 
-		memset(&new[_ansr->public.allocated_height], 0, sizeof(*new) * (new_height - _ansr->public.allocated_height));
-		_ansr->public.allocated_height = new_height;
-		_ansr->public.rows = new;
-	}
+	/* just the parser state, no arena, disp_states or rows are needed */
+	_ansr = _ansr_calloc(&conf->allocator, sizeof(*_ansr));
+	if (!_ansr)
+		return -ENOMEM;
 
-	if (_ansr->cursor_y >= _ansr->public.height)
-		_ansr->public.height = _ansr->cursor_y + 1;
+	_ansr->public.conf = *conf;
+	_ansr->public.conf.events = (ansr_events_t){};
+	_ansr->measure = &measure;
 
-	if (!_ansr->public.rows[_ansr->cursor_y] || _ansr->cursor_x >= _ansr->public.rows[_ansr->cursor_y]->allocated_width) { /* expand cols */
-		size_t		old_width = _ansr->public.rows[_ansr->cursor_y] ? _ansr->public.rows[_ansr->cursor_y]->allocated_width : 0;
-		size_t		new_width = MAX(old_width * 2, ANSR_MIN_ALLOC_COLS);
-		ansr_row_t	*new;
+	r = ansr_write(&_ansr->public, input, input_len);
+	ansr_free(&_ansr->public);
+	if (r < 0)
+		return r;
 
-		new = realloc(_ansr->public.rows[_ansr->cursor_y], sizeof(ansr_row_t) + new_width * sizeof(ansr_char_t));
-		if (!new)
-			return -ENOMEM;
+	*res_width = measure.width;
+	*res_height = measure.height;
 
-		memset(&new->cols[old_width], 0, (new_width - old_width) * sizeof(ansr_char_t));
-		if (!_ansr->public.rows[_ansr->cursor_y])
-			new->width = 0;
-		new->allocated_width = new_width;
-		_ansr->public.rows[_ansr->cursor_y] = new;
-	}
+	return 0;
+}
 
-	_ansr->public.rows[_ansr->cursor_y]->cols[_ansr->cursor_x].code = c;
-	_ansr->public.rows[_ansr->cursor_y]->cols[_ansr->cursor_x].disp_state = _ansr->disp_state;
 
-	_ansr->cursor_x++;
+static size_t _ansr_row_hash(const ansr_row_t *row)
+{
+	uint32_t	h = 0x811c9dc5 ^ row->width;
 
-	if (_ansr->public.rows[_ansr->cursor_y]->width < _ansr->cursor_x)
-		_ansr->public.rows[_ansr->cursor_y]->width = _ansr->cursor_x;
+	for (unsigned x = 0; x < row->width; x++) {
+		h = (h ^ (unsigned char)row->codes[x]) * 0x01000193;
+		h = (h ^ row->disp_states[x]) * 0x01000193;
+	}
 
-	return 0;
+	return _ansr_disp_hash(h);
 }
 
 
-/* returns negative value on error */
-int ansr_write(ansr_t *ansr, char *input, size_t input_len)
+static inline int _ansr_row_equal(const ansr_row_t *a, const ansr_row_t *b)
 {
-	_ansr_t	*_ansr = (_ansr_t *)ansr;
+	return	a->width == b->width &&
+		!memcmp(a->codes, b->codes, a->width) &&
+		!memcmp(a->disp_states, b->disp_states, a->width * sizeof(*a->disp_states));
+}
 
-	assert(ansr);
-	assert(input);
 
-	for (size_t i = 0; i < input_len; i++) {
-		char	c = input[i];
+/* clear the no longer referenced row and keep it for reuse, it's just left to the arena if that fails */
+static void _ansr_row_release(_ansr_t *_ansr, ansr_row_t *row)
+{
+	memset(row->codes, 0, row->width);
+	memset(row->disp_states, 0, row->width * sizeof(*row->disp_states));
+	row->width = 0;
+	row->refs = 1;
 
-		switch (_ansr->state) {
-		case ANSR_STATE_INPUT:
-			switch (c) {
-			case 0x7: /* BELL - tingaling */
-				break;
+	if (_ansr->n_spare_rows == _ansr->n_spare_rows_allocated) {
+		unsigned	newsize = MAX(ANSR_MIN_ALLOC_SPARE_ROWS, _ansr->n_spare_rows_allocated * 2);
+		ansr_row_t	**new;
 
-			case 0x8: /* Backspace - move cursor back horizontally */
-				if (_ansr->cursor_x > 0)
-					_ansr->cursor_x--;
-				break;
+		if (!_ansr_arena_fits(_ansr, newsize * sizeof(*new)))
+			return;
 
-			case 0x9: /* HT - horizontal tab */
-				assert(0);
-				break;
+		new = _ansr_grow(_ansr, _ansr->spare_rows, _ansr->n_spare_rows_allocated * sizeof(*new), newsize * sizeof(*new));
+		if (!new)
+			return;
 
-			case 0x0a: /* LF - move to next line, scroll display up if at bottom of screen, no horiz change */
-				/* TODO: scrolling? for now we just always expand rows/cols to fit rendering */
-				_ansr->cursor_y++;
-				break;
+		_ansr->spare_rows = new;
+		_ansr->n_spare_rows_allocated = newsize;
+	}
 
-			case 0x0c: /* FF - move to start of new page but not changing horizontally */
-				assert(0); /* XXX: there isn't really a concept of a "page" when there's no screen dimensions */
-				break;
+	_ansr->spare_rows[_ansr->n_spare_rows++] = row;
+}
 
-			case 0x0d: /* CR - move the cursor to column 0 */
-				_ansr->cursor_x = 0;
-				break;
 
-			case 0x1a: /* SUB / EOF */
-				_ansr->state = ANSR_STATE_EOF;
-				break;
+/* make all rows with identical cells share the storage of one, see ansr_row_t.refs.
+ * the rows no longer used are kept for reuse by later writes, which copy
+ * shared rows before modifying them.  only separately allocated rows are
+ * deduplicated, this does nothing with conf.grid or conf.sparse.
+ * returns -errno on failure (ENOMEM)
+ */
+int ansr_dedup(ansr_t *ansr)
+{
+	_ansr_t		*_ansr = (_ansr_t *)ansr;
+	size_t		n_buckets = 16;
+	ansr_row_t	**buckets;
 
-			case 0x1b: /* ESC */
-				_ansr->state = ANSR_STATE_ESCAPE;
-				break;
+	assert(ansr);
 
-			case 0x7f: /* DEL */
-				break;
+	if (ansr->stride || _ansr_sparse(_ansr) || !ansr->height)
+		return 0;
 
-			case 0x20: /* SP - move cursor forward horizontally (we just add a space char which vis should treat as transparent) */
-			default:
-				_ansr_add_char(_ansr, c);
-				break;
-			}
-			break;
+	while (n_buckets < (size_t)ansr->height * 2)
+		n_buckets *= 2;
 
-		case ANSR_STATE_EOF:
-			/* just discard everything after EOF.
-			 * SAUCE parsing is deliberately not handled by libansr.
-			 */
-			break;
+	buckets = _ansr_calloc(&ansr->conf.allocator, n_buckets * sizeof(*buckets));
+	if (!buckets)
+		return -ENOMEM;
 
-		case ANSR_STATE_ESCAPE:
-			switch (c) {
-			/* TODO: "Fe Escape sequences" / C0 C1 handling? */
-			case 0x5b: /* '[' */
-				_ansr->state = ANSR_STATE_CSI;
-				_ansr->accumulator = 0;
-				_ansr->n_params = 0;
-				break;
+	for (unsigned y = 0; y < ansr->height; y++) {
+		ansr_row_t	*row = ansr->rows[y], *shared;
+		size_t		b;
 
-			default:
-				assert(0);
-				break;
-			}
-			break;
+		if (!row)
+			continue;
 
-		case ANSR_STATE_CSI:
-			switch (c) {
-			case 0x30 ... 0x39:	/* CSI "parameter bytes" 0-9 */
-				_ansr->accumulator *= 10;
-				_ansr->accumulator += c - 0x30;
+		for (b = _ansr_row_hash(row) & (n_buckets - 1); buckets[b]; b = (b + 1) & (n_buckets - 1)) {
+			if (buckets[b] == row || _ansr_row_equal(buckets[b], row))
 				break;
+		}
 
-			case 0x3a:		/* CSI "parameter bytes" ':' */
-				/* TODO: what does ':' do anyways? */
-				assert(0);
-				break;
+		shared = buckets[b];
+		if (!shared) {
+			buckets[b] = row;
+			continue;
+		}
 
-			case 0x3b:		/* CSI "parameter bytes" ';' */
-				assert(!_ansr_params_append_accumulator(_ansr));
-				break;
+		if (shared == row) /* already shared from an earlier ansr_dedup() */
+			continue;
 
-			case 0x3c ... 0x3f:	/* "private" CSI "parameter bytes" */
-				assert(0);	/* TODO: maybe never */
-				break;
+		shared->refs++;
+		_ansr->n_rows_shared++;
+		_ansr->bytes_shared += _ansr_row_size(shared->allocated_width);
+		ansr->rows[y] = shared;
 
-			case 0x20 ... 0x2f:	/* "nF" sequence intermediate bytes */
-				assert(0);	/* TODO: maybe never */
-				break;
+		if (--row->refs) {
+			_ansr->n_rows_shared--;
+			_ansr->bytes_shared -= _ansr_row_size(row->allocated_width);
+		} else {
+			_ansr_row_release(_ansr, row);
+		}
+	}
 
-			case 0x40 ... 0x6f:	/* final bytes, append accumulator */
-			case 0x70 ... 0x7e:	/* "private" final bytes */
-				assert(!_ansr_params_append_accumulator(_ansr));
-				break;
+	_ansr_free(&ansr->conf.allocator, buckets, n_buckets * sizeof(*buckets));
 
-			default:
-				assert(0);
-				break;
-			}
+	return 0;
+}
 
-			/* final byte switch */
-			switch (c) {
-			/* 0x40 ... 0x6f:	final bytes */
-			case 0x41: {		/* cursor up N bytes (default 1) */
-				unsigned	n = 1;
 
-				if (_ansr->n_params)
-					n = _ansr->params[0];
+/* get the code and display state handle of the cell at x,y whatever the canvas layout.
+ * cells never written are 0, as are those beyond the canvas.
+ */
+void ansr_cell(ansr_t *ansr, unsigned x, unsigned y, char *res_code, uint16_t *res_disp_state)
+{
+	ansr_row_t	*row;
 
-				_ansr->cursor_y -= MIN(_ansr->cursor_y, n);
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
-			}
+	assert(ansr);
+	assert(res_code);
+	assert(res_disp_state);
 
-			case 0x42:		/* cursor down N bytes (default 1) */
-				_ansr->cursor_y += _ansr->n_params ? _ansr->params[0] : 1;
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+	*res_code = 0;
+	*res_disp_state = 0;
 
-			case 0x43:		/* cursor forward N bytes (default 1) */
-				_ansr->cursor_x += _ansr->n_params ? _ansr->params[0] : 1;
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+	if (y >= ansr->height || !(row = ansr->rows[y]) || x >= row->width)
+		return;
 
-			case 0x44:		/* cursor back N bytes (default 1) */
-				assert(0); /* TODO */
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+	if (_ansr_sparse((_ansr_t *)ansr)) {
+		for (unsigned i = 0; i < row->n_runs && row->runs[i].x <= x; i++) {
+			ansr_row_t	*cells = row->runs[i].cells;
 
-			case 0x45:		/* cursor start of next N line (default 1) */
-				assert(0); /* TODO */
-				_ansr->state = ANSR_STATE_INPUT;
+			if (x - row->runs[i].x < cells->width) {
+				*res_code = cells->codes[x - row->runs[i].x];
+				*res_disp_state = cells->disp_states[x - row->runs[i].x];
 				break;
+			}
+		}
 
-			case 0x46:		/* cursor start of previous N line (default 1) */
-				assert(0); /* TODO */
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+		return;
+	}
 
-			case 0x47:		/* cursor horiz absolute/column N (default 1) */
-				_ansr->cursor_x = _ansr->n_params ? (_ansr->params[0] - 1) : 0;
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+	*res_code = row->codes[x];
+	*res_disp_state = row->disp_states[x];
+}
 
-			case 0x48: {		/* cursor position row N col M (N;M) (defaults to 1 when omitted, 1-based coords) */
-				unsigned	r = 0, c = 0;
 
-				if (_ansr->n_params >= 1)
-					r = _ansr->params[0] - 1;
-				if (_ansr->n_params == 2)
-					c = _ansr->params[1] - 1;
+/* fill res_stats with the memory use of ansr, and what input it skipped */
+void ansr_stats(ansr_t *ansr, ansr_stats_t *res_stats)
+{
+	_ansr_t		*_ansr = (_ansr_t *)ansr;
+	ansr_stats_t	stats = {};
+	size_t		own;
 
-				_ansr->cursor_y = r;
-				_ansr->cursor_x = c;
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
-			}
+	assert(ansr);
+	assert(res_stats);
 
-			case 0x49: /* ?? */
-				assert(0); /* TODO */
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+	/* what's ours alone regardless of arena */
+	own = sizeof(*_ansr) +
+	      _ansr->n_disp_states_allocated * sizeof(*ansr->disp_states) +
+	      _ansr->n_disp_buckets * sizeof(*_ansr->disp_buckets);
 
-			case 0x4a:		/* erase in display, if n is 0 or missing erase from cursor to end of screen.  if n is 1 from cursor to beginning of screen, 2 entire screen, 3 entire and scrollback */
-				/* TODO? we don't assert here because some ansis start with erase, but I'm not bothering with actually implementing it */
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+	stats.bytes_allocated = _ansr_bytes(_ansr);
 
-			case 0x4b:		/* erase in line, n=0 or missing erase to end of line,  n=1 to beginning of line, n=2 entire line.  cursor pos doesn't change */
-				assert(0); /* TODO */
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+	stats.bytes_used = own + ansr->allocated_height * sizeof(*ansr->rows);
 
-			case 0x53:		/* scroll up */
-				assert(0); /* TODO */
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+	for (unsigned y = 0; y < ansr->allocated_height; y++) {
+		ansr_row_t	*row = ansr->rows[y];
 
-			case 0x54:		/* scroll down */
-				assert(0); /* TODO */
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+		if (!row)
+			continue;
 
-			case 0x66:		/* horiz vert position - same as 0x48 */
-				assert(0); /* TODO */
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+		stats.rows_allocated++;
+		stats.bytes_used += _ansr_row_size(row->allocated_width);
+		if (_ansr_sparse(_ansr)) {
+			stats.bytes_used += row->allocated_runs * sizeof(*row->runs);
+			for (unsigned i = 0; i < row->allocated_runs; i++) {
+				ansr_row_t	*cells = row->runs[i].cells;
 
-			case 0x6d:		/* select graphic rendition n (SGR) */
-				_ansr_sgr(_ansr);
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+				if (!cells) /* spare */
+					continue;
 
-			case 0x70 ... 0x7e:	/* "private" final bytes */
-				/* TODO: maybe never? or drop on floor (log something?) */
-				_ansr->state = ANSR_STATE_INPUT;
-				break;
+				stats.cells_allocated += cells->allocated_width;
+				stats.cells_used += cells->width;
+				stats.bytes_used += _ansr_row_size(cells->allocated_width);
 			}
-
-			break;
-
-		default:
-			assert(0);
-			break;
+			continue;
 		}
+
+		stats.cells_allocated += row->allocated_width;
+		stats.cells_used += row->width;
 	}
 
-	return 0;
+	stats.rows = ansr->height;
+	stats.disp_states = ansr->n_disp_states;
+	stats.reallocs = _ansr->n_reallocs;
+	stats.cells_clipped = _ansr->n_clipped;
+	stats.rows_shared = _ansr->n_rows_shared;
+	stats.bytes_shared = _ansr->bytes_shared;
+	stats.bytes_used -= _ansr->bytes_shared;	/* counted once per row above */
+	stats.unsupported = _ansr->unsupported;
+	stats.sgr_cache_hits = _ansr->n_sgr_cache_hits;
+	stats.sgr_cache_misses = _ansr->n_sgr_cache_misses;
+
+	*res_stats = stats;
 }
 
 
@@ -632,10 +2329,17 @@ ansr_t * ansr_free(ansr_t *ansr)
 {
 	_ansr_t	*_ansr = (_ansr_t *)ansr;
 
-	if (_ansr)
-		free(_ansr->params);
+	if (_ansr) {
+		ansr_allocator_t	allocator = ansr->conf.allocator;
 
-	free(_ansr);
+		/* the rows all go with the arena */
+		if (_ansr->own_arena)
+			ansr_arena_free(_ansr->arena);
+
+		_ansr_free(&allocator, _ansr->public.disp_states, _ansr->n_disp_states_allocated * sizeof(*_ansr->public.disp_states));
+		_ansr_free(&allocator, _ansr->disp_buckets, _ansr->n_disp_buckets * sizeof(*_ansr->disp_buckets));
+		_ansr_free(&allocator, _ansr, sizeof(*_ansr));
+	}
 
 	return NULL;
 }
@@ -17,9 +17,26 @@
 #ifndef _ANSR_H
 #define _ANSR_H
 
-typedef struct ansr_conf_t {
-	unsigned	screen_width, screen_lines;	/* explicit overrides, 0 for defaults (80x24) */
-} ansr_conf_t;
+#include <stddef.h>
+#include <stdint.h>
+
+/* optional allocator hooks for all memory libansr allocates, NULL for libc.
+ * malloc and free must be supplied together, realloc may be omitted.
+ * the sizes passed are always exact, for precise accounting.
+ */
+typedef struct ansr_allocator_t {
+	void *		(*malloc)(void *ctx, size_t size);
+	void *		(*realloc)(void *ctx, void *ptr, size_t old_size, size_t size);
+	void		(*free)(void *ctx, void *ptr, size_t size);
+	void		*ctx;
+} ansr_allocator_t;
+
+/* arenas hand out the canvas storage of ansr instances from large slabs,
+ * which is only ever released all at once.  supplying one in ansr_conf_t
+ * lets it outlive and be shared by a series of instances, e.g. reset between
+ * inputs in a batch.  arenas are not thread-safe.
+ */
+typedef struct ansr_arena_t ansr_arena_t;
 
 typedef enum ansr_color_t {
 	ANSR_COLOR_BLACK,
@@ -30,6 +47,14 @@ typedef enum ansr_color_t {
 	ANSR_COLOR_MAGENTA,
 	ANSR_COLOR_CYAN,
 	ANSR_COLOR_WHITE,
+	ANSR_COLOR_BRIGHT_BLACK,
+	ANSR_COLOR_BRIGHT_RED,
+	ANSR_COLOR_BRIGHT_GREEN,
+	ANSR_COLOR_BRIGHT_YELLOW,
+	ANSR_COLOR_BRIGHT_BLUE,
+	ANSR_COLOR_BRIGHT_MAGENTA,
+	ANSR_COLOR_BRIGHT_CYAN,
+	ANSR_COLOR_BRIGHT_WHITE,
 } ansr_color_t;
 
 typedef struct ansr_disp_state_t {
@@ -61,24 +86,136 @@ typedef struct ansr_disp_state_t {
 	} attrs;
 } ansr_disp_state_t;
 
-typedef struct ansr_char_t {
-	char			code;
-	ansr_disp_state_t	disp_state;
-} ansr_char_t;
+/* event mode: with events.span set, ansr_write() hands every span of cells
+ * to it instead of placing them on the canvas, which is never allocated and
+ * stays empty, only the width of each row is kept for erasing to its end.
+ * replaying the spans in order builds the canvas ansr_new() would have.
+ * spans are already wrapped and clipped to conf.max_rows/max_cols.
+ * text points into the input passed to ansr_write() and is only valid for
+ * the duration of the call, as is disp_state.  spans without text (erasures)
+ * are n cells of fill.  returning a negative value fails ansr_write() with it.
+ */
+typedef struct ansr_events_t {
+	int		(*span)(void *ctx, unsigned x, unsigned y, const ansr_disp_state_t *disp_state, const char *text, char fill, size_t n);
+	void		*ctx;
+} ansr_events_t;
+
+typedef struct ansr_conf_t {
+	unsigned	screen_width, screen_lines;	/* explicit overrides, 0 for defaults (80x24) */
+	ansr_arena_t	*arena;				/* optional caller-owned arena, NULL for a private one */
+	ansr_allocator_t allocator;			/* optional allocator hooks, fixed for an instance's lifetime */
+
+	/* optional resource budgets, 0 for unlimited.
+	 * cells beyond max_rows/max_cols are clipped (see ansr_stats_t.cells_clipped),
+	 * storage growing beyond max_bytes fails ansr_write() with -ENOSPC, it's
+	 * checked before allocating so ansr_stats_t.bytes_allocated stays within it.
+	 * that's everything a private arena holds, but only what's been taken
+	 * from a caller-supplied one, whose slabs are the caller's.
+	 */
+	unsigned	max_rows, max_cols;
+	size_t		max_bytes;
+
+	/* optional expected canvas extent, for laying it out in one allocation up front.
+	 * with measure set, ansr_new() runs ansr_measure() on its input for this instead.
+	 */
+	unsigned	expected_width, expected_height;
+	unsigned	measure:1;
 
+	/* lay the canvas out as a single grid of fixed stride, the larger of
+	 * screen_width and expected_width, see ansr_t.stride.  cells past the
+	 * stride are clipped.  ignored without either width.
+	 */
+	unsigned	grid:1;
+
+	/* store only the written cells of rows, as runs (see ansr_row_t.runs),
+	 * for canvases mostly left blank by cursor movement.  ignored with grid.
+	 */
+	unsigned	sparse:1;
+
+	/* unsupported input is skipped and counted (see ansr_stats_t.unsupported),
+	 * in strict mode it additionally fails ansr_write() with -ENOTSUP.
+	 */
+	unsigned	strict:1;
+
+	ansr_events_t	events;				/* optional event mode, see ansr_events_t */
+} ansr_conf_t;
+
+typedef struct ansr_run_t ansr_run_t;
+
+/* rows store their cells as parallel arrays: the glyph codes, and the
+ * display state of each as a handle, an index into ansr_t.disp_states where
+ * every distinct display state on the canvas is stored once.
+ * handle 0 is always the zeroed state of untouched cells.
+ * with conf.sparse, rows have no cells of their own (allocated_width is 0),
+ * those written are in n_runs runs sorted by column instead.  width remains
+ * the extent of the row.  ansr_cell() reads a cell in either layout.
+ */
 typedef struct ansr_row_t {
 	unsigned		width, allocated_width;
-	ansr_char_t		cols[];
+	char			*codes;
+	uint16_t		*disp_states;
+	unsigned		n_runs, allocated_runs;
+	ansr_run_t		*runs;
+	unsigned		refs;		/* rows sharing this one after ansr_dedup(), 1 when unshared */
 } ansr_row_t;
 
+/* cells->width cells of a sparse row, starting at column x */
+struct ansr_run_t {
+	unsigned		x;
+	ansr_row_t		*cells;
+};
+
 typedef struct ansr_t {
 	ansr_conf_t		conf;
 	unsigned		height, allocated_height;
 	ansr_row_t		**rows;
+	unsigned		n_disp_states;
+	ansr_disp_state_t	*disp_states;	/* indexed by ansr_row_t.disp_states[], may move on ansr_write() */
+
+	/* with conf.grid the rows are views of allocated_height rows of stride
+	 * cells in these two planes, which may move on ansr_write().  stride is 0 otherwise.
+	 */
+	unsigned		stride;
+	char			*grid_codes;
+	uint16_t		*grid_disp_states;
 } ansr_t;
 
+/* counts of input skipped as unsupported */
+typedef struct ansr_unsupported_t {
+	unsigned	controls;			/* C0 controls (FF) */
+	unsigned	escapes;			/* escape sequences other than CSI */
+	unsigned	csi[0x3f];			/* CSI sequences by final byte - 0x40 */
+	unsigned	csi_private;			/* CSI sequences with private params or intermediate bytes */
+	unsigned	sgr[108];			/* SGR params (and 38/48/58 colors) by value */
+	unsigned	sgr_other;			/* SGR params beyond sgr[] */
+	unsigned	malformed;			/* sequences cut short or with params out of range */
+} ansr_unsupported_t;
+
+typedef struct ansr_stats_t {
+	size_t		bytes_allocated;		/* everything held on ansr's behalf, including arena slack */
+	size_t		bytes_used;			/* of that, what live structures occupy */
+	unsigned	rows, rows_allocated;		/* ansr.height, and rows having storage */
+	size_t		cells_allocated, cells_used;	/* sum of rows allocated_width, width */
+	unsigned	disp_states;			/* unique display states */
+	unsigned	reallocs;			/* growths of already allocated storage */
+	size_t		cells_clipped;			/* cells dropped by conf.max_rows/max_cols */
+	unsigned	rows_shared;			/* rows sharing another's storage after ansr_dedup() */
+	size_t		bytes_shared;			/* storage those rows would take unshared, not in bytes_used */
+	ansr_unsupported_t unsupported;
+	unsigned	sgr_cache_hits, sgr_cache_misses;	/* SGR sequences applied from/added to the cache */
+} ansr_stats_t;
+
+ansr_arena_t * ansr_arena_new(ansr_allocator_t *allocator, size_t slab_size);
+void ansr_arena_reset(ansr_arena_t *arena);
+ansr_arena_t * ansr_arena_free(ansr_arena_t *arena);
+
 ansr_t * ansr_new(ansr_conf_t *conf, char *input, size_t input_len);
+int ansr_reset(ansr_t *ansr, ansr_conf_t *conf);
 int ansr_write(ansr_t *ansr, char *input, size_t input_len);
+int ansr_dedup(ansr_t *ansr);
+int ansr_measure(ansr_conf_t *conf, char *input, size_t input_len, unsigned *res_width, unsigned *res_height);
+void ansr_cell(ansr_t *ansr, unsigned x, unsigned y, char *res_code, uint16_t *res_disp_state);
+void ansr_stats(ansr_t *ansr, ansr_stats_t *res_stats);
 ansr_t * ansr_free(ansr_t *ansr);
 
 #endif
@@ -0,0 +1,522 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ansr.h"
+#include "ansr_png.h"
+
+/* the zlib stream is a single deflate block using the fixed huffman codes,
+ * with matches found through hash chains over a sliding 32KiB window.
+ * it's written out in IDAT chunks of up to ANSR_PNG_IDAT_SIZE bytes.
+ */
+#define ANSR_PNG_IDAT_SIZE	32768
+#define ANSR_PNG_WSIZE		32768			/* deflate window */
+#define ANSR_PNG_WMASK		(ANSR_PNG_WSIZE - 1)
+#define ANSR_PNG_HASH_BITS	15
+#define ANSR_PNG_MIN_MATCH	3
+#define ANSR_PNG_MAX_MATCH	258
+#define ANSR_PNG_MAX_CHAIN	16			/* candidates tried per match */
+#define ANSR_PNG_GOOD_MATCH	64			/* long enough to stop looking */
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+
+struct ansr_png_t {
+	ansr_allocator_t	allocator;
+	size_t			size;
+	int			(*write)(void *ctx, const void *buf, size_t len);
+	void			*ctx;
+	int			error;			/* sticky error from write */
+
+	unsigned		width, height;
+	unsigned		next_y;			/* rows written */
+	uint8_t			plte[16 * 3];
+	uint32_t		crc_table[256];
+
+	/* rows are width + 1 bytes, the leading one the filter type */
+	uint8_t			*prev_row, *row, *row_sub, *row_up;
+
+	/* deflate state, positions are offsets into the filtered data (+ 1 in head/prev, 0 for none) */
+	uint32_t		adler;
+	size_t			base;			/* position of win[0] */
+	unsigned		win_len, pos;		/* bytes in win, and those of them already compressed */
+	uint64_t		bits;
+	unsigned		n_bits;
+	uint16_t		lit_codes[288];		/* fixed huffman codes, bit reversed */
+	uint8_t			lit_lens[288];
+	size_t			head[1 << ANSR_PNG_HASH_BITS];
+	size_t			prev[ANSR_PNG_WSIZE];
+	uint8_t			win[2 * ANSR_PNG_WSIZE];
+
+	/* the IDAT chunk being filled, with room for its header and crc */
+	unsigned		out_len;
+	uint8_t			out[8 + ANSR_PNG_IDAT_SIZE + 4];
+};
+
+const uint32_t ansr_palette_indices[16] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
+
+
+static inline void _ansr_png_be32(uint8_t *dst, uint32_t v)
+{
+	dst[0] = v >> 24;
+	dst[1] = v >> 16;
+	dst[2] = v >> 8;
+	dst[3] = v;
+}
+
+
+static uint32_t _ansr_png_crc(const ansr_png_t *png, uint32_t crc, const uint8_t *buf, size_t len)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++)
+		crc = png->crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+
+static uint32_t _ansr_png_adler(uint32_t adler, const uint8_t *buf, size_t len)
+{
+	uint32_t	a = adler & 0xffff, b = adler >> 16;
+
+	while (len) {
+		size_t	n = MIN(len, 5552);	/* the most before b can overflow */
+
+		len -= n;
+		for (; n; n--) {
+			a += *(buf++);
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+
+	return b << 16 | a;
+}
+
+
+/* write a chunk of type with the len bytes of data at chunk + 8, where chunk
+ * has room for the length and type before, and the crc after, the data.
+ */
+static int _ansr_png_chunk(ansr_png_t *png, const char *type, uint8_t *chunk, size_t len)
+{
+	int	r;
+
+	if (png->error)
+		return png->error;
+
+	_ansr_png_be32(chunk, len);
+	memcpy(&chunk[4], type, 4);
+	_ansr_png_be32(&chunk[8 + len], _ansr_png_crc(png, 0, &chunk[4], 4 + len));
+
+	r = png->write(png->ctx, chunk, 8 + len + 4);
+	if (r < 0)
+		png->error = r;
+
+	return png->error;
+}
+
+
+static void _ansr_png_flush_idat(ansr_png_t *png)
+{
+	if (png->out_len)
+		_ansr_png_chunk(png, "IDAT", png->out, png->out_len);
+
+	png->out_len = 0;
+}
+
+
+/* add the n low bits of v to the stream, least significant first */
+static inline void _ansr_png_bits(ansr_png_t *png, uint32_t v, unsigned n)
+{
+	png->bits |= (uint64_t)v << png->n_bits;
+	png->n_bits += n;
+
+	while (png->n_bits >= 8) {
+		png->out[8 + png->out_len++] = png->bits;
+		png->bits >>= 8;
+		png->n_bits -= 8;
+
+		if (png->out_len == ANSR_PNG_IDAT_SIZE)
+			_ansr_png_flush_idat(png);
+	}
+}
+
+
+static inline void _ansr_png_literal(ansr_png_t *png, unsigned v)
+{
+	_ansr_png_bits(png, png->lit_codes[v], png->lit_lens[v]);
+}
+
+
+static inline unsigned _ansr_png_rev(unsigned v, unsigned n)
+{
+	unsigned	r = 0;
+
+	for (unsigned i = 0; i < n; i++, v >>= 1)
+		r = r << 1 | (v & 1);
+
+	return r;
+}
+
+
+static void _ansr_png_match(ansr_png_t *png, unsigned len, unsigned dist)
+{
+	unsigned	v, l;
+
+	/* length codes 257-284 cover 3-257 in groups of 4 doubling in size, 285 is 258 */
+	v = len - ANSR_PNG_MIN_MATCH;
+	if (len == ANSR_PNG_MAX_MATCH) {
+		_ansr_png_literal(png, 285);
+	} else if (v < 8) {
+		_ansr_png_literal(png, 257 + v);
+	} else {
+		l = 31 - __builtin_clz(v);
+		_ansr_png_literal(png, 257 + 4 * (l - 1) + ((v >> (l - 2)) & 3));
+		_ansr_png_bits(png, v & ((1 << (l - 2)) - 1), l - 2);
+	}
+
+	/* distance codes 0-29 cover 1-32768 in pairs doubling in size */
+	v = dist - 1;
+	if (v < 4) {
+		_ansr_png_bits(png, _ansr_png_rev(v, 5), 5);
+	} else {
+		l = 31 - __builtin_clz(v);
+		_ansr_png_bits(png, _ansr_png_rev(2 * l + ((v >> (l - 1)) & 1), 5), 5);
+		_ansr_png_bits(png, v & ((1 << (l - 1)) - 1), l - 1);
+	}
+}
+
+
+static inline unsigned _ansr_png_hash(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u >> (32 - ANSR_PNG_HASH_BITS);
+}
+
+
+/* insert the position at i in win into the hash chains */
+static inline void _ansr_png_insert(ansr_png_t *png, unsigned i)
+{
+	unsigned	h = _ansr_png_hash(&png->win[i]);
+	size_t		p = png->base + i;
+
+	png->prev[p & ANSR_PNG_WMASK] = png->head[h];
+	png->head[h] = p + 1;
+}
+
+
+/* compress the window up to where matches could still be extended by more
+ * input, or all of it when final.
+ */
+static void _ansr_png_deflate(ansr_png_t *png, int final)
+{
+	unsigned	end = final ? png->win_len : png->win_len - ANSR_PNG_MAX_MATCH;
+
+	while (png->pos < end) {
+		unsigned	avail = png->win_len - png->pos, best_len = 0, best_dist = 0;
+		const uint8_t	*cur = &png->win[png->pos];
+
+		if (avail >= ANSR_PNG_MIN_MATCH) {
+			size_t		p = png->base + png->pos, c;
+			unsigned	max_len = MIN(avail, ANSR_PNG_MAX_MATCH);
+
+			c = png->head[_ansr_png_hash(cur)];
+			for (unsigned chain = 0; chain < ANSR_PNG_MAX_CHAIN && c-- && c >= png->base && p - c <= ANSR_PNG_WSIZE; chain++) {
+				const uint8_t	*cand = &png->win[c - png->base];
+				unsigned	len = 0;
+				size_t		next;
+
+				if (cand[best_len] == cur[best_len]) {
+					while (len < max_len && cand[len] == cur[len])
+						len++;
+
+					if (len > best_len) {
+						best_len = len;
+						best_dist = p - c;
+						if (len >= ANSR_PNG_GOOD_MATCH || len == max_len)
+							break;
+					}
+				}
+
+				/* chains only ever go back, a newer entry means the slot was reused */
+				next = png->prev[c & ANSR_PNG_WMASK];
+				if (next > c)
+					break;
+				c = next;
+			}
+		}
+
+		if (best_len >= ANSR_PNG_MIN_MATCH) {
+			_ansr_png_match(png, best_len, best_dist);
+			for (unsigned i = 0; i < best_len; i++, png->pos++) {
+				if (png->pos + ANSR_PNG_MIN_MATCH <= png->win_len)
+					_ansr_png_insert(png, png->pos);
+			}
+		} else {
+			_ansr_png_literal(png, *cur);
+			if (avail >= ANSR_PNG_MIN_MATCH)
+				_ansr_png_insert(png, png->pos);
+			png->pos++;
+		}
+	}
+}
+
+
+/* add len bytes of filtered data to the zlib stream */
+static void _ansr_png_zlib(ansr_png_t *png, const uint8_t *buf, size_t len)
+{
+	png->adler = _ansr_png_adler(png->adler, buf, len);
+
+	while (len) {
+		unsigned	n;
+
+		if (png->win_len == sizeof(png->win)) {
+			/* compressing first leaves at most MAX_MATCH pending, far below the half slid out */
+			_ansr_png_deflate(png, 0);
+			memmove(png->win, &png->win[ANSR_PNG_WSIZE], ANSR_PNG_WSIZE);
+			png->base += ANSR_PNG_WSIZE;
+			png->win_len -= ANSR_PNG_WSIZE;
+			png->pos -= ANSR_PNG_WSIZE;
+		}
+
+		n = MIN(len, sizeof(png->win) - png->win_len);
+		memcpy(&png->win[png->win_len], buf, n);
+		png->win_len += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+
+/* filter png->row against png->prev_row, returning the one of none, sub or up
+ * with the smallest sum of absolute (signed) differences, the usual heuristic.
+ */
+static const uint8_t * _ansr_png_filter(ansr_png_t *png)
+{
+	const uint8_t	*row = png->row, *prev = png->prev_row;
+	uint8_t		*sub = png->row_sub, *up = png->row_up;
+	unsigned	sum_none = 0, sum_sub = 0, sum_up = 0;
+
+	sub[0] = 1;
+	up[0] = 2;
+	for (unsigned i = 1; i <= png->width; i++) {
+		sub[i] = row[i] - (i > 1 ? row[i - 1] : 0);
+		up[i] = row[i] - prev[i];
+
+		sum_none += row[i];
+		sum_sub += sub[i] < 128 ? sub[i] : 256 - sub[i];
+		sum_up += up[i] < 128 ? up[i] : 256 - up[i];
+	}
+
+	if (sum_up < sum_none && sum_up <= sum_sub)
+		return up;
+
+	if (sum_sub < sum_none)
+		return sub;
+
+	return row;
+}
+
+
+static void _ansr_png_begin(ansr_png_t *png)
+{
+	uint8_t	buf[8 + 16 * 3 + 4];
+	int	r;
+
+	r = png->write(png->ctx, "\x89PNG\r\n\x1a\n", 8);
+	if (r < 0) {
+		png->error = r;
+		return;
+	}
+
+	_ansr_png_be32(&buf[8], png->width);
+	_ansr_png_be32(&buf[12], png->height);
+	buf[16] = 8;	/* bit depth */
+	buf[17] = 3;	/* indexed color */
+	buf[18] = 0;	/* deflate */
+	buf[19] = 0;	/* adaptive filtering */
+	buf[20] = 0;	/* no interlace */
+	if (_ansr_png_chunk(png, "IHDR", buf, 13))
+		return;
+
+	memcpy(&buf[8], png->plte, sizeof(png->plte));
+	if (_ansr_png_chunk(png, "PLTE", buf, sizeof(png->plte)))
+		return;
+
+	/* zlib header (32K window, fastest), then the one block's final bit and fixed type */
+	png->out[8] = 0x78;
+	png->out[9] = 0x01;
+	png->out_len = 2;
+	_ansr_png_bits(png, 1 | 1 << 1, 3);
+}
+
+
+static void _ansr_png_end(ansr_png_t *png)
+{
+	uint8_t	buf[8 + 4];
+
+	_ansr_png_deflate(png, 1);
+	_ansr_png_literal(png, 256);
+	_ansr_png_bits(png, 0, (8 - png->n_bits) & 7);
+
+	for (int i = 24; i >= 0; i -= 8)
+		_ansr_png_bits(png, (png->adler >> i) & 0xff, 8);
+
+	_ansr_png_flush_idat(png);
+	_ansr_png_chunk(png, "IEND", buf, 0);
+}
+
+
+/* create an encoder of a width x height PNG colored by palette (16 colors as
+ * R,G,B,A bytes in memory, like ansr_palette_vga, alpha is ignored), writing
+ * it through write(ctx, buf, len) which returns a negative value on failure.
+ * returns NULL on failure (EINVAL, ENOMEM)
+ */
+ansr_png_t * ansr_png_new(ansr_allocator_t *allocator, unsigned width, unsigned height, const uint32_t *palette, int (*write)(void *ctx, const void *buf, size_t len), void *ctx)
+{
+	ansr_allocator_t	libc = {};
+	ansr_png_t		*png;
+	size_t			size;
+
+	assert(palette);
+	assert(write);
+
+	if (!allocator)
+		allocator = &libc;
+
+	assert(!allocator->malloc == !allocator->free);
+
+	/* PNG dimensions are limited to 31 bits */
+	if (!width || !height || width > INT32_MAX || height > INT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size = sizeof(*png) + 4 * ((size_t)width + 1);
+	png = allocator->malloc ? allocator->malloc(allocator->ctx, size) : malloc(size);
+	if (!png)
+		return NULL;
+
+	memset(png, 0, size);
+	png->allocator = *allocator;
+	png->size = size;
+	png->write = write;
+	png->ctx = ctx;
+	png->width = width;
+	png->height = height;
+	png->adler = 1;
+	png->prev_row = (uint8_t *)&png[1];
+	png->row = &png->prev_row[width + 1];
+	png->row_sub = &png->row[width + 1];
+	png->row_up = &png->row_sub[width + 1];
+
+	for (unsigned i = 0; i < 16; i++)
+		memcpy(&png->plte[i * 3], &palette[i], 3);
+
+	for (unsigned i = 0; i < 256; i++) {
+		uint32_t	c = i;
+
+		for (unsigned k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+		png->crc_table[i] = c;
+	}
+
+	for (unsigned i = 0; i < 288; i++) {
+		switch (i) {
+		case 0 ... 143:
+			png->lit_lens[i] = 8;
+			png->lit_codes[i] = _ansr_png_rev(0x30 + i, 8);
+			break;
+		case 144 ... 255:
+			png->lit_lens[i] = 9;
+			png->lit_codes[i] = _ansr_png_rev(0x190 + i - 144, 9);
+			break;
+		case 256 ... 279:
+			png->lit_lens[i] = 7;
+			png->lit_codes[i] = _ansr_png_rev(i - 256, 7);
+			break;
+		default:
+			png->lit_lens[i] = 8;
+			png->lit_codes[i] = _ansr_png_rev(0xc0 + i - 280, 8);
+			break;
+		}
+	}
+
+	return png;
+}
+
+
+/* encode height rows of pixels (color indices, pitch pixels apart) starting
+ * at row y, which must follow the rows encoded so far.  the PNG is complete
+ * once its last row is encoded.  the signature matches the func of
+ * ansr_render_strips(), for encoding strips as they're rendered.
+ * returns -errno on failure (EINVAL), or the negative value write failed with.
+ */
+int ansr_png_strip(void *_png, const uint32_t *pixels, unsigned y, unsigned height, unsigned pitch)
+{
+	ansr_png_t	*png = _png;
+
+	assert(png);
+	assert(pixels || !height);
+
+	if (png->error)
+		return png->error;
+
+	if (y != png->next_y || height > png->height - y || pitch < png->width)
+		return -EINVAL;
+
+	if (!y && height)
+		_ansr_png_begin(png);
+
+	for (unsigned r = 0; r < height && !png->error; r++, pixels += pitch) {
+		uint8_t	*t;
+
+		png->row[0] = 0;
+		for (unsigned i = 0; i < png->width; i++)
+			png->row[1 + i] = pixels[i];
+
+		_ansr_png_zlib(png, _ansr_png_filter(png), png->width + 1);
+
+		t = png->prev_row;
+		png->prev_row = png->row;
+		png->row = t;
+	}
+
+	png->next_y += height;
+	if (png->next_y == png->height && height && !png->error)
+		_ansr_png_end(png);
+
+	return png->error;
+}
+
+
+ansr_png_t * ansr_png_free(ansr_png_t *png)
+{
+	if (png) {
+		if (png->allocator.free)
+			png->allocator.free(png->allocator.ctx, png, png->size);
+		else
+			free(png);
+	}
+
+	return NULL;
+}
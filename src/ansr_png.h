@@ -0,0 +1,44 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ANSR_PNG_H
+#define _ANSR_PNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ansr.h"
+
+/* streaming encoder of 8-bit palette-indexed PNGs, fed rows of color indices
+ * in order and writing the encoded PNG to a sink as it goes.  rendering with
+ * ansr_palette_indices as the palette produces those indices, e.g.:
+ *
+ *   cache = ansr_glyph_cache_new(NULL, &font, ansr_palette_indices, 0);
+ *   png = ansr_png_new(NULL, width, height, ansr_palette_vga, write, ctx);
+ *   ansr_render_strips(ansr, cache, width, height, strip, 8, ansr_png_strip, png);
+ *
+ * png encoders are not thread-safe.
+ */
+typedef struct ansr_png_t ansr_png_t;
+
+/* the palette of color indices, entry n is n */
+extern const uint32_t ansr_palette_indices[16];
+
+ansr_png_t * ansr_png_new(ansr_allocator_t *allocator, unsigned width, unsigned height, const uint32_t *palette, int (*write)(void *ctx, const void *buf, size_t len), void *ctx);
+int ansr_png_strip(void *png, const uint32_t *pixels, unsigned y, unsigned height, unsigned pitch);
+ansr_png_t * ansr_png_free(ansr_png_t *png);
+
+#endif
@@ -0,0 +1,587 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "ansr.h"
+#include "ansr_render.h"
+
+#define ANSR_RENDER_GLYPH_WIDTH		8
+#define ANSR_RENDER_MAX_GLYPH_HEIGHT	32
+#define ANSR_RENDER_CHUNK		64	/* cells resolved at a time per text row */
+#define ANSR_GLYPH_CACHE_KEYS		(256 * 16 * 16)	/* (code, fg, bg) */
+#define ANSR_GLYPH_CACHE_TILES		1024	/* default max_tiles */
+#define ANSR_GLYPH_CACHE_MAX_TILES	(ANSR_GLYPH_CACHE_KEYS - 1)
+#define ANSR_GLYPH_CACHE_NIL		0xffff
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define RGBA(_r, _g, _b)	((uint32_t)(_r) << 24 | (uint32_t)(_g) << 16 | (uint32_t)(_b) << 8 | 0xffu)
+#else
+#define RGBA(_r, _g, _b)	(0xffu << 24 | (uint32_t)(_b) << 16 | (uint32_t)(_g) << 8 | (uint32_t)(_r))
+#endif
+
+const uint32_t ansr_palette_vga[16] = {
+	[ANSR_COLOR_BLACK] =		RGBA(0x00, 0x00, 0x00),
+	[ANSR_COLOR_RED] =		RGBA(0xaa, 0x00, 0x00),
+	[ANSR_COLOR_GREEN] =		RGBA(0x00, 0xaa, 0x00),
+	[ANSR_COLOR_YELLOW] =		RGBA(0xaa, 0x55, 0x00),
+	[ANSR_COLOR_BLUE] =		RGBA(0x00, 0x00, 0xaa),
+	[ANSR_COLOR_MAGENTA] =		RGBA(0xaa, 0x00, 0xaa),
+	[ANSR_COLOR_CYAN] =		RGBA(0x00, 0xaa, 0xaa),
+	[ANSR_COLOR_WHITE] =		RGBA(0xaa, 0xaa, 0xaa),
+	[ANSR_COLOR_BRIGHT_BLACK] =	RGBA(0x55, 0x55, 0x55),
+	[ANSR_COLOR_BRIGHT_RED] =	RGBA(0xff, 0x55, 0x55),
+	[ANSR_COLOR_BRIGHT_GREEN] =	RGBA(0x55, 0xff, 0x55),
+	[ANSR_COLOR_BRIGHT_YELLOW] =	RGBA(0xff, 0xff, 0x55),
+	[ANSR_COLOR_BRIGHT_BLUE] =	RGBA(0x55, 0x55, 0xff),
+	[ANSR_COLOR_BRIGHT_MAGENTA] =	RGBA(0xff, 0x55, 0xff),
+	[ANSR_COLOR_BRIGHT_CYAN] =	RGBA(0x55, 0xff, 0xff),
+	[ANSR_COLOR_BRIGHT_WHITE] =	RGBA(0xff, 0xff, 0xff),
+};
+
+/* the cache is one allocation: this, then the per-slot arrays and tiles */
+struct ansr_glyph_cache_t {
+	ansr_allocator_t	allocator;
+	size_t			size;
+	ansr_font_t		font;
+	uint32_t		palette[16];
+	unsigned		tile_size;			/* pixels per tile */
+	unsigned		max_tiles, n_tiles;
+	uint16_t		head, tail;			/* most/least recently used slots */
+	size_t			hits, misses, evictions;
+	uint16_t		index[ANSR_GLYPH_CACHE_KEYS];	/* slot + 1 of each key, 0 when uncached */
+	uint16_t		*keys, *prev, *next;		/* per slot: key, and the LRU list */
+	uint32_t		*tiles;				/* per slot: tile_size pixels, a glyph row at a time */
+};
+
+/* resolve the cell at x of row (which may be NULL) to its glyph code and palette colors.
+ * cells must be resolved left to right along a row, *run starting at 0 for
+ * every row: it's where the runs of a conf.sparse row are walked from.
+ */
+static inline void _ansr_render_cell(ansr_t *ansr, ansr_row_t *row, unsigned x, unsigned *run, unsigned *res_code, unsigned *res_fg, unsigned *res_bg)
+{
+	const ansr_disp_state_t	*disp_state;
+	unsigned		fg, bg;
+	uint16_t		handle = 0;
+	char			code = 0;
+
+	if (row && x < row->width) {
+		if (x < row->allocated_width) {
+			code = row->codes[x];
+			handle = row->disp_states[x];
+		} else { /* conf.sparse rows keep their cells in runs sorted by column */
+			while (*run < row->n_runs && row->runs[*run].x + row->runs[*run].cells->width <= x)
+				(*run)++;
+
+			if (*run < row->n_runs && x >= row->runs[*run].x) {
+				ansr_run_t	*r = &row->runs[*run];
+
+				code = r->cells->codes[x - r->x];
+				handle = r->cells->disp_states[x - r->x];
+			}
+		}
+	}
+
+	/* only untouched cells are left out of disp_states in event mode */
+	if (handle >= ansr->n_disp_states) {
+		*res_code = 0;
+		*res_fg = *res_bg = ANSR_COLOR_BLACK;
+		return;
+	}
+
+	disp_state = &ansr->disp_states[handle];
+	fg = disp_state->colors.fg & 0xf;
+	bg = disp_state->colors.bg & 0xf;
+
+	/* bold is bright in the 16 color world of ANSI art */
+	if (disp_state->attrs.bold && fg < ANSR_COLOR_BRIGHT_BLACK)
+		fg += ANSR_COLOR_BRIGHT_BLACK;
+
+	if (disp_state->attrs.invert) {
+		unsigned	t = fg;
+
+		fg = bg;
+		bg = t;
+	}
+
+	if (disp_state->attrs.conceal)
+		fg = bg;
+
+	*res_code = (unsigned char)code;
+	*res_fg = fg;
+	*res_bg = bg;
+}
+
+
+/* expand the 8 pixels of glyph row bits into dst, fg where set and bg elsewhere */
+static inline void _ansr_render_bits(uint32_t *dst, unsigned bits, uint32_t fg, uint32_t bg)
+{
+#if defined(__AVX2__)
+	const __m256i	bit = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	__m256i		m;
+
+	m = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), bit), bit);
+	_mm256_storeu_si256((__m256i *)dst, _mm256_blendv_epi8(_mm256_set1_epi32(bg), _mm256_set1_epi32(fg), m));
+#elif defined(__SSE2__)
+	const __m128i	hi = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10), lo = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+	__m128i		b = _mm_set1_epi32(bits), f = _mm_set1_epi32(fg), g = _mm_set1_epi32(bg), m;
+
+	m = _mm_cmpeq_epi32(_mm_and_si128(b, hi), hi);
+	_mm_storeu_si128((__m128i *)&dst[0], _mm_or_si128(_mm_and_si128(m, f), _mm_andnot_si128(m, g)));
+	m = _mm_cmpeq_epi32(_mm_and_si128(b, lo), lo);
+	_mm_storeu_si128((__m128i *)&dst[4], _mm_or_si128(_mm_and_si128(m, f), _mm_andnot_si128(m, g)));
+#else
+	for (unsigned i = 0; i < ANSR_RENDER_GLYPH_WIDTH; i++)
+		dst[i] = (bits & (0x80 >> i)) ? fg : bg;
+#endif
+}
+
+
+/* rasterize text rows first_row up to last_row of the canvas of ansr into their part of pixels */
+static void _ansr_render(ansr_t *ansr, const ansr_font_t *font, const uint32_t *palette, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch, unsigned first_row, unsigned last_row)
+{
+	unsigned	cols = (width + ANSR_RENDER_GLYPH_WIDTH - 1) / ANSR_RENDER_GLYPH_WIDTH;
+
+	for (unsigned y = first_row; y < last_row; y++) {
+		ansr_row_t	*row = y < ansr->height ? ansr->rows[y] : NULL;
+		unsigned	glyph_rows = MIN(font->height, height - y * font->height);
+		unsigned	run = 0;
+
+		for (unsigned x = 0; x < cols; x += ANSR_RENDER_CHUNK) {
+			struct {
+				const uint8_t	*glyph;
+				uint32_t	fg, bg;
+			}			cells[ANSR_RENDER_CHUNK];
+			unsigned		n = MIN(ANSR_RENDER_CHUNK, cols - x);
+
+			for (unsigned i = 0; i < n; i++) {
+				unsigned	code, fg, bg;
+
+				_ansr_render_cell(ansr, row, x + i, &run, &code, &fg, &bg);
+				cells[i].glyph = &font->glyphs[code * font->height];
+				cells[i].fg = palette[fg];
+				cells[i].bg = palette[bg];
+			}
+
+			/* a pixel row at a time across the chunk, so the writes stream */
+			for (unsigned r = 0; r < glyph_rows; r++) {
+				uint32_t	*dst = &pixels[(size_t)(y * font->height + r) * pitch + x * ANSR_RENDER_GLYPH_WIDTH];
+				unsigned	whole = n;
+
+				/* the last column may be cut off by width */
+				if (x + n == cols && width % ANSR_RENDER_GLYPH_WIDTH)
+					whole--;
+
+				for (unsigned i = 0; i < whole; i++, dst += ANSR_RENDER_GLYPH_WIDTH)
+					_ansr_render_bits(dst, cells[i].glyph[r], cells[i].fg, cells[i].bg);
+
+				if (whole < n) {
+					uint32_t	tmp[ANSR_RENDER_GLYPH_WIDTH];
+
+					_ansr_render_bits(tmp, cells[whole].glyph[r], cells[whole].fg, cells[whole].bg);
+					memcpy(dst, tmp, (width % ANSR_RENDER_GLYPH_WIDTH) * sizeof(*dst));
+				}
+			}
+		}
+	}
+}
+
+
+/* rasterize the canvas of ansr into pixels using font and palette (16 colors indexed by ansr_color_t).
+ * pixels is width x height, with pitch pixels from one row to the next, and is
+ * entirely overwritten: cells not on the canvas are drawn blank in black.
+ * palette colors are stored verbatim, so they determine the pixel format.
+ * returns -errno on failure (EINVAL)
+ */
+int ansr_render_rgba(ansr_t *ansr, const ansr_font_t *font, const uint32_t *palette, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch)
+{
+	return ansr_render_rgba_rows(ansr, font, palette, pixels, width, height, pitch, 0, UINT_MAX);
+}
+
+
+/* rasterize like ansr_render_rgba(), but only the n_rows text rows from
+ * first_row of the pixels, leaving the rest of them untouched.  calls on
+ * disjoint rows of the same pixels can run concurrently, e.g. to spread
+ * rendering across a thread pool.
+ * returns -errno on failure (EINVAL)
+ */
+int ansr_render_rgba_rows(ansr_t *ansr, const ansr_font_t *font, const uint32_t *palette, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch, unsigned first_row, unsigned n_rows)
+{
+	unsigned	rows;
+
+	assert(ansr);
+	assert(font);
+	assert(palette);
+	assert(pixels || !height);
+
+	if (!font->height || font->height > ANSR_RENDER_MAX_GLYPH_HEIGHT || !font->glyphs || pitch < width)
+		return -EINVAL;
+
+	rows = (height + font->height - 1) / font->height;
+	if (first_row < rows)
+		_ansr_render(ansr, font, palette, pixels, width, height, pitch, first_row, first_row + MIN(n_rows, rows - first_row));
+
+	return 0;
+}
+
+
+typedef struct ansr_render_band_t {
+	pthread_t		thread;
+	ansr_t			*ansr;
+	const ansr_font_t	*font;
+	const uint32_t		*palette;
+	uint32_t		*pixels;
+	unsigned		width, height, pitch;
+	unsigned		first_row, last_row;
+} ansr_render_band_t;
+
+
+static void * _ansr_render_band(void *arg)
+{
+	ansr_render_band_t	*band = arg;
+
+	_ansr_render(band->ansr, band->font, band->palette, band->pixels, band->width, band->height, band->pitch, band->first_row, band->last_row);
+
+	return NULL;
+}
+
+
+/* rasterize like ansr_render_rgba(), split into bands of text rows rendered
+ * by up to n_threads threads (ANSR_RENDER_MAX_THREADS at most), the calling
+ * thread included.  bands that can't get a thread are rendered by the caller.
+ * returns -errno on failure (EINVAL)
+ */
+int ansr_render_rgba_threaded(ansr_t *ansr, const ansr_font_t *font, const uint32_t *palette, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch, unsigned n_threads)
+{
+	ansr_render_band_t	bands[ANSR_RENDER_MAX_THREADS];
+	unsigned		rows, n_bands;
+
+	assert(ansr);
+	assert(font);
+	assert(palette);
+	assert(pixels || !height);
+
+	if (!font->height || font->height > ANSR_RENDER_MAX_GLYPH_HEIGHT || !font->glyphs || pitch < width)
+		return -EINVAL;
+
+	rows = (height + font->height - 1) / font->height;
+	n_bands = MIN(MIN(MAX(n_threads, 1), ANSR_RENDER_MAX_THREADS), MAX(rows, 1));
+
+	for (unsigned i = 0; i < n_bands; i++) {
+		bands[i] = (ansr_render_band_t){
+			.ansr = ansr,
+			.font = font,
+			.palette = palette,
+			.pixels = pixels,
+			.width = width,
+			.height = height,
+			.pitch = pitch,
+			.first_row = (uint64_t)rows * i / n_bands,
+			.last_row = (uint64_t)rows * (i + 1) / n_bands,
+		};
+	}
+
+	/* band 0 is the caller's, the rest get threads if they can */
+	for (unsigned i = 1; i < n_bands; i++) {
+		if (pthread_create(&bands[i].thread, NULL, _ansr_render_band, &bands[i])) {
+			for (unsigned j = i; j < n_bands; j++)
+				_ansr_render_band(&bands[j]);
+
+			n_bands = i;
+			break;
+		}
+	}
+
+	_ansr_render_band(&bands[0]);
+
+	for (unsigned i = 1; i < n_bands; i++)
+		pthread_join(bands[i].thread, NULL);
+
+	return 0;
+}
+
+
+/* create a cache of up to max_tiles (0 for a default of 1024) expanded glyph tiles of font in palette.
+ * the font's glyphs must outlive the cache, palette is copied.
+ * returns NULL on failure (EINVAL, ENOMEM)
+ */
+ansr_glyph_cache_t * ansr_glyph_cache_new(ansr_allocator_t *allocator, const ansr_font_t *font, const uint32_t *palette, unsigned max_tiles)
+{
+	ansr_allocator_t	libc = {};
+	ansr_glyph_cache_t	*cache;
+	unsigned		tile_size;
+	size_t			size;
+
+	assert(font);
+	assert(palette);
+
+	if (!allocator)
+		allocator = &libc;
+
+	assert(!allocator->malloc == !allocator->free);
+
+	if (!font->height || font->height > ANSR_RENDER_MAX_GLYPH_HEIGHT || !font->glyphs) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!max_tiles)
+		max_tiles = ANSR_GLYPH_CACHE_TILES;
+
+	max_tiles = MIN(max_tiles, ANSR_GLYPH_CACHE_MAX_TILES);
+	tile_size = ANSR_RENDER_GLYPH_WIDTH * font->height;
+
+	/* the uint16_t arrays are a multiple of 4 bytes in total, keeping the tiles aligned */
+	size = sizeof(*cache) + ((3 * sizeof(uint16_t) + tile_size * sizeof(uint32_t)) * (size_t)max_tiles) + (max_tiles & 1) * 3 * sizeof(uint16_t);
+	cache = allocator->malloc ? allocator->malloc(allocator->ctx, size) : malloc(size);
+	if (!cache)
+		return NULL;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->allocator = *allocator;
+	cache->size = size;
+	cache->font = *font;
+	memcpy(cache->palette, palette, sizeof(cache->palette));
+	cache->tile_size = tile_size;
+	cache->max_tiles = max_tiles;
+	cache->head = cache->tail = ANSR_GLYPH_CACHE_NIL;
+	cache->keys = (uint16_t *)&cache[1];
+	cache->prev = &cache->keys[max_tiles + (max_tiles & 1)];
+	cache->next = &cache->prev[max_tiles + (max_tiles & 1)];
+	cache->tiles = (uint32_t *)&cache->next[max_tiles + (max_tiles & 1)];
+
+	return cache;
+}
+
+
+/* return the tile for key, expanding it on a miss, and make it the most recently used */
+static const uint32_t * _ansr_glyph_cache_tile(ansr_glyph_cache_t *cache, unsigned key)
+{
+	unsigned	slot = cache->index[key];
+
+	if (slot--) {
+		cache->hits++;
+
+		if (slot == cache->head)
+			return &cache->tiles[slot * cache->tile_size];
+
+		/* unlink, it's not the head so has a prev */
+		cache->next[cache->prev[slot]] = cache->next[slot];
+		if (cache->next[slot] != ANSR_GLYPH_CACHE_NIL)
+			cache->prev[cache->next[slot]] = cache->prev[slot];
+		else
+			cache->tail = cache->prev[slot];
+	} else {
+		const uint8_t	*glyph = &cache->font.glyphs[(key >> 8) * cache->font.height];
+		uint32_t	fg = cache->palette[(key >> 4) & 0xf], bg = cache->palette[key & 0xf];
+		uint32_t	*tile;
+
+		cache->misses++;
+
+		if (cache->n_tiles < cache->max_tiles) {
+			slot = cache->n_tiles++;
+		} else {
+			/* evict the tail */
+			slot = cache->tail;
+			cache->tail = cache->prev[slot];
+			if (cache->tail != ANSR_GLYPH_CACHE_NIL)
+				cache->next[cache->tail] = ANSR_GLYPH_CACHE_NIL;
+			else /* max_tiles of 1 */
+				cache->head = ANSR_GLYPH_CACHE_NIL;
+
+			cache->index[cache->keys[slot]] = 0;
+			cache->evictions++;
+		}
+
+		cache->keys[slot] = key;
+		cache->index[key] = slot + 1;
+
+		tile = &cache->tiles[slot * cache->tile_size];
+		for (unsigned r = 0; r < cache->font.height; r++, tile += ANSR_RENDER_GLYPH_WIDTH)
+			_ansr_render_bits(tile, glyph[r], fg, bg);
+
+		if (cache->tail == ANSR_GLYPH_CACHE_NIL)
+			cache->tail = slot;
+	}
+
+	/* push onto the head */
+	cache->prev[slot] = ANSR_GLYPH_CACHE_NIL;
+	cache->next[slot] = cache->head;
+	if (cache->head != ANSR_GLYPH_CACHE_NIL)
+		cache->prev[cache->head] = slot;
+	cache->head = slot;
+
+	return &cache->tiles[slot * cache->tile_size];
+}
+
+
+/* rasterize the canvas of ansr from text row first_row down into pixels through cache */
+static void _ansr_render_cached(ansr_t *ansr, ansr_glyph_cache_t *cache, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch, unsigned first_row)
+{
+	unsigned	font_height, cols, rows, chunk;
+
+	font_height = cache->font.height;
+	cols = (width + ANSR_RENDER_GLYPH_WIDTH - 1) / ANSR_RENDER_GLYPH_WIDTH;
+	rows = (height + font_height - 1) / font_height;
+
+	/* the tiles of a chunk are its most recently used, so no more than max_tiles
+	 * of them can't evict one another before they're copied.
+	 */
+	chunk = MIN(ANSR_RENDER_CHUNK, cache->max_tiles);
+
+	for (unsigned y = 0; y < rows; y++) {
+		ansr_row_t	*row = first_row + y < ansr->height ? ansr->rows[first_row + y] : NULL;
+		unsigned	glyph_rows = MIN(font_height, height - y * font_height);
+		const uint32_t	*tile = NULL;
+		unsigned	last_key = ~0U;
+		unsigned	run = 0;
+
+		for (unsigned x = 0; x < cols; x += chunk) {
+			const uint32_t	*tiles[ANSR_RENDER_CHUNK];
+			unsigned	n = MIN(chunk, cols - x);
+
+			for (unsigned i = 0; i < n; i++) {
+				unsigned	code, fg, bg, key;
+
+				_ansr_render_cell(ansr, row, x + i, &run, &code, &fg, &bg);
+				key = code << 8 | fg << 4 | bg;
+
+				/* runs of the same cell are common, skip the lookup for them */
+				if (key != last_key) {
+					tile = _ansr_glyph_cache_tile(cache, key);
+					last_key = key;
+				} else {
+					cache->hits++;
+				}
+
+				tiles[i] = tile;
+			}
+
+			/* a pixel row at a time across the chunk, so the writes stream */
+			for (unsigned r = 0; r < glyph_rows; r++) {
+				uint32_t	*dst = &pixels[(size_t)(y * font_height + r) * pitch + x * ANSR_RENDER_GLYPH_WIDTH];
+				unsigned	whole = n;
+
+				/* the last column may be cut off by width */
+				if (x + n == cols && width % ANSR_RENDER_GLYPH_WIDTH)
+					whole--;
+
+				for (unsigned i = 0; i < whole; i++, dst += ANSR_RENDER_GLYPH_WIDTH)
+					memcpy(dst, &tiles[i][r * ANSR_RENDER_GLYPH_WIDTH], ANSR_RENDER_GLYPH_WIDTH * sizeof(*dst));
+
+				if (whole < n)
+					memcpy(dst, &tiles[whole][r * ANSR_RENDER_GLYPH_WIDTH], (width % ANSR_RENDER_GLYPH_WIDTH) * sizeof(*dst));
+			}
+		}
+	}
+}
+
+
+/* rasterize the canvas of ansr into pixels like ansr_render_rgba(), using the
+ * font and palette of cache and copying the cells from its tiles.
+ * returns -errno on failure (EINVAL)
+ */
+int ansr_render_rgba_cached(ansr_t *ansr, ansr_glyph_cache_t *cache, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch)
+{
+	assert(ansr);
+	assert(cache);
+	assert(pixels || !height);
+
+	if (pitch < width)
+		return -EINVAL;
+
+	_ansr_render_cached(ansr, cache, pixels, width, height, pitch, 0);
+
+	return 0;
+}
+
+
+/* rasterize the canvas of ansr like ansr_render_rgba_cached(), but into strip
+ * a strip of strip_rows text rows at a time, handing each to func before
+ * reusing strip for the next.  strip holds width x (strip_rows * font height)
+ * pixels, so memory use is independent of the canvas height.  func gets the
+ * strip's pixels (pitch is width), its first pixel row y, and its height in
+ * pixel rows, which is short on the last strip when height isn't a multiple.
+ * returning a negative value from func stops rendering, failing with it.
+ * returns -errno on failure (EINVAL)
+ */
+int ansr_render_strips(ansr_t *ansr, ansr_glyph_cache_t *cache, unsigned width, unsigned height, uint32_t *strip, unsigned strip_rows, int (*func)(void *ctx, const uint32_t *pixels, unsigned y, unsigned height, unsigned pitch), void *ctx)
+{
+	unsigned	strip_height;
+
+	assert(ansr);
+	assert(cache);
+	assert(strip);
+	assert(func);
+
+	if (!strip_rows || !width)
+		return -EINVAL;
+
+	strip_height = strip_rows * cache->font.height;
+
+	for (unsigned y = 0; y < height; y += strip_height) {
+		unsigned	n = MIN(strip_height, height - y);
+		int		r;
+
+		_ansr_render_cached(ansr, cache, strip, width, n, width, y / cache->font.height);
+
+		r = func(ctx, strip, y, n, width);
+		if (r < 0)
+			return r;
+	}
+
+	return 0;
+}
+
+
+void ansr_glyph_cache_stats(ansr_glyph_cache_t *cache, ansr_glyph_cache_stats_t *res_stats)
+{
+	assert(cache);
+	assert(res_stats);
+
+	*res_stats = (ansr_glyph_cache_stats_t){
+		.tiles = cache->n_tiles,
+		.max_tiles = cache->max_tiles,
+		.bytes_allocated = cache->size,
+		.hits = cache->hits,
+		.misses = cache->misses,
+		.evictions = cache->evictions,
+	};
+}
+
+
+ansr_glyph_cache_t * ansr_glyph_cache_free(ansr_glyph_cache_t *cache)
+{
+	if (cache) {
+		if (cache->allocator.free)
+			cache->allocator.free(cache->allocator.ctx, cache, cache->size);
+		else
+			free(cache);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ANSR_RENDER_H
+#define _ANSR_RENDER_H
+
+#include <stdint.h>
+
+#include "ansr.h"
+
+/* a 256 glyph bitmap font like the CP437 VGA ones, glyphs are 8 pixels wide
+ * and height rows tall, each row a byte with the leftmost pixel in the MSB.
+ */
+typedef struct ansr_font_t {
+	unsigned	height;				/* 8 or 16 typically, up to 32 */
+	const uint8_t	*glyphs;			/* 256 * height bytes, glyph by glyph */
+} ansr_font_t;
+
+/* the 16 colors of the standard VGA text mode palette, indexed by ansr_color_t,
+ * as R,G,B,A bytes in memory.
+ */
+extern const uint32_t ansr_palette_vga[16];
+
+/* glyph caches keep fully expanded glyph tiles of a font and palette, one per
+ * distinct (code, fg, bg) combination rendered, so rendering a cell through
+ * one is a tile copy.  they hold up to max_tiles tiles, evicting the least
+ * recently used.  glyph caches are not thread-safe.
+ */
+typedef struct ansr_glyph_cache_t ansr_glyph_cache_t;
+
+typedef struct ansr_glyph_cache_stats_t {
+	unsigned	tiles, max_tiles;		/* tiles cached, and the bound */
+	size_t		bytes_allocated;		/* held by the cache */
+	size_t		hits, misses;			/* cells rendered from a cached/newly expanded tile */
+	size_t		evictions;			/* tiles evicted to make room */
+} ansr_glyph_cache_stats_t;
+
+#define ANSR_RENDER_MAX_THREADS	64			/* for ansr_render_rgba_threaded() */
+
+int ansr_render_rgba(ansr_t *ansr, const ansr_font_t *font, const uint32_t *palette, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch);
+int ansr_render_rgba_rows(ansr_t *ansr, const ansr_font_t *font, const uint32_t *palette, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch, unsigned first_row, unsigned n_rows);
+int ansr_render_rgba_threaded(ansr_t *ansr, const ansr_font_t *font, const uint32_t *palette, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch, unsigned n_threads);
+
+ansr_glyph_cache_t * ansr_glyph_cache_new(ansr_allocator_t *allocator, const ansr_font_t *font, const uint32_t *palette, unsigned max_tiles);
+int ansr_render_rgba_cached(ansr_t *ansr, ansr_glyph_cache_t *cache, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch);
+int ansr_render_strips(ansr_t *ansr, ansr_glyph_cache_t *cache, unsigned width, unsigned height, uint32_t *strip, unsigned strip_rows, int (*func)(void *ctx, const uint32_t *pixels, unsigned y, unsigned height, unsigned pitch), void *ctx);
+void ansr_glyph_cache_stats(ansr_glyph_cache_t *cache, ansr_glyph_cache_stats_t *res_stats);
+ansr_glyph_cache_t * ansr_glyph_cache_free(ansr_glyph_cache_t *cache);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* parser microbenchmark: times ansr_write() over generated SGR-heavy and
+ * plain text inputs.  bench_parse uses the ansr_actions table dispatch,
+ * bench_parse_switch is the same built with -DANSR_SWITCH_ACTIONS for the
+ * nested switches it replaced, so the two are comparable run for run:
+ *
+ *   make check && ./bench_parse && ./bench_parse_switch
+ *
+ * an optional argument sets the number of timed passes over each input.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ansr.h"
+
+#define BENCH_INPUT_SIZE	(4 * 1024 * 1024)
+#define BENCH_PASSES		10
+
+static uint64_t	rng;
+
+
+static unsigned bench_rand(unsigned n)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng % n;
+}
+
+
+/* lines of short runs of text each preceded by an SGR, like most ANSI art */
+static size_t bench_generate_sgr(char *buf, size_t size)
+{
+	size_t	len = 0;
+
+	while (size - len > 64) {
+		for (unsigned x = 0; x < 80 && size - len > 64;) {
+			unsigned	n = 1 + bench_rand(4);
+
+			len += sprintf(&buf[len], "\x1b[%u;%u;%um", bench_rand(2), 30 + bench_rand(8), 40 + bench_rand(8));
+			for (unsigned k = 0; k < n; k++)
+				buf[len++] = bench_rand(3) ? (char)(0xb0 + bench_rand(4)) : (char)(0x20 + bench_rand(0x5f));
+			x += n;
+		}
+
+		len += sprintf(&buf[len], "\r\n");
+	}
+
+	return len;
+}
+
+
+/* lines of text without any escape sequences */
+static size_t bench_generate_plain(char *buf, size_t size)
+{
+	size_t	len = 0;
+
+	while (size - len > 128) {
+		for (unsigned n = bench_rand(80); n; n--)
+			buf[len++] = 0x20 + bench_rand(0x5f);
+
+		len += sprintf(&buf[len], "\r\n");
+	}
+
+	return len;
+}
+
+
+static int bench_run(const char *name, char *input, size_t len, unsigned passes)
+{
+	ansr_conf_t	conf = { .screen_width = 80 };
+	ansr_t		*ansr;
+	double		secs = 0;
+
+	ansr = ansr_new(&conf, NULL, 0);
+	if (!ansr)
+		return -1;
+
+	for (unsigned pass = 0; pass <= passes; pass++) {
+		struct timespec	t0, t1;
+
+		if (ansr_reset(ansr, &conf) < 0)
+			goto _err;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (ansr_write(ansr, input, len) < 0)
+			goto _err;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+
+		/* the first pass grows the canvas and isn't counted */
+		if (pass)
+			secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	}
+
+	printf("%s: %zu bytes x %u in %.3fs, %.1f MB/s\n", name, len, passes, secs, (double)len * passes / secs / 1e6);
+	ansr_free(ansr);
+
+	return 0;
+
+_err:
+	ansr_free(ansr);
+
+	return -1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	unsigned	passes = BENCH_PASSES;
+	char		*input;
+	size_t		len;
+	int		failed = 0;
+
+	if (argc > 1)
+		passes = atoi(argv[1]);
+
+	if (!passes)
+		return EXIT_FAILURE;
+
+	input = malloc(BENCH_INPUT_SIZE);
+	if (!input)
+		return EXIT_FAILURE;
+
+	rng = 0x9e3779b97f4a7c15ull;
+	len = bench_generate_sgr(input, BENCH_INPUT_SIZE);
+	if (bench_run("sgr", input, len, passes) < 0)
+		failed = 1;
+
+	len = bench_generate_plain(input, BENCH_INPUT_SIZE);
+	if (bench_run("plain", input, len, passes) < 0)
+		failed = 1;
+
+	free(input);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
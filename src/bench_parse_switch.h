@@ -0,0 +1,88 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BENCH_PARSE_SWITCH_H
+#define _BENCH_PARSE_SWITCH_H
+
+/* the classification of ansr_actions by nested switches, as ansr_write()
+ * used to do it.  ansr.c classifies with it instead when built with
+ * -DANSR_SWITCH_ACTIONS, for comparing the two in bench_parse_switch, and
+ * test_actions checks they agree.  it's included by ansr.c after ansr_action_t.
+ */
+static inline ansr_action_t _ansr_switch_action(ansr_state_t state, unsigned char c)
+{
+	switch (state) {
+	case ANSR_STATE_INPUT:
+		switch (c) {
+		case 0x07:
+		case 0x7f:
+			return ANSR_ACTION_IGNORE;
+		case 0x08:
+			return ANSR_ACTION_BS;
+		case 0x09:
+			return ANSR_ACTION_HT;
+		case 0x0a:
+			return ANSR_ACTION_LF;
+		case 0x0c:
+			return ANSR_ACTION_CONTROL;
+		case 0x0d:
+			return ANSR_ACTION_CR;
+		case 0x1a:
+			return ANSR_ACTION_SUB;
+		case 0x1b:
+			return ANSR_ACTION_ESC;
+		default:
+			return ANSR_ACTION_TEXT;
+		}
+
+	case ANSR_STATE_EOF:
+		return ANSR_ACTION_IGNORE;
+
+	case ANSR_STATE_ESCAPE:
+		switch (c) {
+		case 0x5b:
+			return ANSR_ACTION_ESC_CSI;
+		case 0x20 ... 0x2f:
+			return ANSR_ACTION_IGNORE;
+		case 0x30 ... 0x5a:
+		case 0x5c ... 0x7e:
+			return ANSR_ACTION_ESC_FINAL;
+		default:
+			return ANSR_ACTION_ABORT;
+		}
+
+	case ANSR_STATE_CSI:
+		switch (c) {
+		case 0x30 ... 0x39:
+			return ANSR_ACTION_CSI_PARAM;
+		case 0x3a ... 0x3b:
+			return ANSR_ACTION_CSI_SEP;
+		case 0x3c ... 0x3f:
+		case 0x20 ... 0x2f:
+			return ANSR_ACTION_CSI_PRIVATE;
+		case 0x40 ... 0x7e:
+			return ANSR_ACTION_CSI_FINAL;
+		default:
+			return ANSR_ACTION_ABORT;
+		}
+
+	default:
+		assert(0);
+		return ANSR_ACTION_ABORT;
+	}
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* parser classification test: the nested switches bench_parse_switch builds
+ * ansr.c with must classify every byte in every state as the ansr_actions
+ * table does.  the classification is all the two builds differ in, so this
+ * makes them produce the same canvas from any input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ansr.c"
+#include "bench_parse_switch.h"
+
+
+int main(int argc, char *argv[])
+{
+	int	failed = 0;
+
+	for (unsigned state = 0; state < ANSR_STATE_CNT; state++) {
+		for (unsigned c = 0; c < 256; c++) {
+			ansr_action_t	table = _ansr_action(state, c), nested = _ansr_switch_action(state, c);
+
+			if (table != nested) {
+				printf("state %u, byte 0x%02x: ansr_actions gives %u, the switches %u\n", state, c, table, nested);
+				failed = 1;
+			}
+		}
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
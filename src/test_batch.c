@@ -0,0 +1,333 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* batch rendering test and benchmark: runs a batch of generated inputs
+ * through new/write/reset/dedup/render/free the way a thumbnailer does,
+ * in every canvas layout and with private and shared arenas, checking that
+ *  - every canvas renders the same as one freshly created for its input,
+ *  - memory use stops growing once the batch has been seen once,
+ *  - everything allocated is released at the end.
+ * build it with -fsanitize=address to also have LSan/ASan catch leaks and
+ * stray accesses, e.g.: make check CFLAGS="-g -O1 -fsanitize=address"
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ansr.h"
+#include "ansr_render.h"
+
+#define BATCH_SIZE	64
+#define BATCH_PASSES	3
+#define INPUT_MAX	(64 * 1024)
+
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+typedef struct batch_input_t {
+	char		*buf;
+	size_t		len;
+} batch_input_t;
+
+typedef struct batch_conf_t {
+	const char	*name;
+	ansr_conf_t	conf;
+	int		shared_arena;	/* reset a caller-supplied arena between inputs */
+	int		vary;		/* cycle through batch_layouts between inputs */
+} batch_conf_t;
+
+/* the layouts varying configurations cycle through, resets change between them */
+static const ansr_conf_t	batch_layouts[] = {
+	{ .screen_width = 80 },
+	{ .screen_width = 80, .sparse = 1 },
+	{ .screen_width = 80, .grid = 1 },
+	{ .screen_width = 80, .grid = 1, .expected_width = 120 },
+	{ .screen_width = 80, .expected_width = 80, .expected_height = 50 },
+};
+
+static size_t	live, peak;
+static uint64_t	rng;
+static uint8_t	glyphs[256 * 8];
+
+
+static void * batch_malloc(void *ctx, size_t size)
+{
+	live += size;
+	if (live > peak)
+		peak = live;
+
+	return malloc(size);
+}
+
+
+static void * batch_realloc(void *ctx, void *ptr, size_t old_size, size_t size)
+{
+	live += size - old_size;
+	if (live > peak)
+		peak = live;
+
+	return realloc(ptr, size);
+}
+
+
+static void batch_free(void *ctx, void *ptr, size_t size)
+{
+	live -= size;
+	free(ptr);
+}
+
+
+static unsigned batch_rand(unsigned n)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng % n;
+}
+
+
+/* generate an input of SGR-colored text, cursor movement and repeated lines */
+static size_t batch_generate(char *buf, size_t size)
+{
+	unsigned	lines = 1 + batch_rand(200);
+	size_t		len = 0;
+	char		line[1024];
+	size_t		line_len = 0;
+
+	for (unsigned y = 0; y < lines && size - len > sizeof(line) * 2; y++) {
+		/* art repeats lines a lot, which ansr_dedup() is for */
+		if (!line_len || batch_rand(4)) {
+			line_len = 0;
+
+			for (unsigned n = batch_rand(12); n; n--) {
+				line_len += sprintf(&line[line_len], "\x1b[%u;%u;%um", batch_rand(2), 30 + batch_rand(8), 40 + batch_rand(8));
+
+				if (!batch_rand(5))
+					line_len += sprintf(&line[line_len], "\x1b[%uC", 1 + batch_rand(40));
+
+				for (unsigned k = 1 + batch_rand(12); k; k--)
+					line[line_len++] = batch_rand(3) ? (char)(0xb0 + batch_rand(4)) : (char)(0x20 + batch_rand(0x5f));
+			}
+		}
+
+		memcpy(&buf[len], line, line_len);
+		len += line_len;
+
+		if (!batch_rand(10))
+			len += sprintf(&buf[len], "\x1b[%uB", 1 + batch_rand(5));
+		else
+			len += sprintf(&buf[len], "\r\n");
+	}
+
+	return len;
+}
+
+
+/* the width of ansr's widest row */
+static unsigned batch_width(ansr_t *ansr)
+{
+	unsigned	width = 0;
+
+	for (unsigned y = 0; y < ansr->height; y++) {
+		if (ansr->rows[y] && ansr->rows[y]->width > width)
+			width = ansr->rows[y]->width;
+	}
+
+	return width;
+}
+
+
+/* render ansr at 8x8 into a buffer it returns, width x height cells */
+static uint32_t * batch_render(ansr_t *ansr, unsigned width, unsigned height)
+{
+	ansr_font_t	font = { 8, glyphs };
+	uint32_t	*pixels;
+
+	pixels = malloc((size_t)width * 8 * height * 8 * sizeof(*pixels));
+	if (!pixels)
+		return NULL;
+
+	if (ansr_render_rgba(ansr, &font, ansr_palette_vga, pixels, width * 8, height * 8, width * 8) < 0) {
+		free(pixels);
+		return NULL;
+	}
+
+	return pixels;
+}
+
+
+/* does ansr render the same as a fresh instance given input with conf? */
+static int batch_verify(ansr_t *ansr, ansr_conf_t *conf, batch_input_t *input)
+{
+	ansr_conf_t	fresh_conf = *conf;
+	ansr_t		*fresh;
+	uint32_t	*a, *b;
+	unsigned	width, height;
+	int		r = 0;
+
+	fresh_conf.arena = NULL;
+	fresh_conf.allocator = (ansr_allocator_t){};
+	fresh = ansr_new(&fresh_conf, input->buf, input->len);
+	if (!fresh)
+		return -1;
+
+	/* cursor movement can take rows past screen_width, all of both canvases is compared */
+	width = MAX(MAX(batch_width(ansr), batch_width(fresh)), 1);
+	height = MAX(ansr->height, fresh->height);
+	a = batch_render(ansr, width, height);
+	b = batch_render(fresh, width, height);
+	if (!a || !b || memcmp(a, b, (size_t)width * 8 * height * 8 * sizeof(*a)))
+		r = -1;
+
+	free(a);
+	free(b);
+	ansr_free(fresh);
+
+	return r;
+}
+
+
+static int batch_run(batch_conf_t *bc, batch_input_t *inputs)
+{
+	ansr_allocator_t	allocator = { batch_malloc, batch_realloc, batch_free, NULL };
+	ansr_conf_t		conf = bc->conf;
+	ansr_arena_t		*arena = NULL;
+	ansr_t			*ansr = NULL;
+	size_t			pass_peak[BATCH_PASSES] = {};
+	struct timespec		t0, t1;
+	int			failed = 0;
+
+	live = peak = 0;
+	conf.allocator = allocator;
+	if (bc->shared_arena) {
+		arena = ansr_arena_new(&allocator, 0);
+		if (!arena)
+			return -1;
+
+		conf.arena = arena;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (unsigned pass = 0; pass < BATCH_PASSES; pass++) {
+		peak = live;
+
+		for (unsigned i = 0; i < BATCH_SIZE; i++) {
+			batch_input_t	*input = &inputs[i];
+
+			if (bc->vary) {
+				conf = batch_layouts[i % (sizeof(batch_layouts) / sizeof(batch_layouts[0]))];
+				conf.allocator = allocator;
+				conf.arena = arena;
+			}
+
+			/* the arena may only be reset while nothing's using it */
+			if (!ansr) {
+				if (arena)
+					ansr_arena_reset(arena);
+
+				ansr = ansr_new(&conf, NULL, 0);
+				if (!ansr)
+					return -1;
+			} else {
+				if (ansr_reset(ansr, &conf) < 0)
+					return -1;
+
+				if (arena)
+					ansr_arena_reset(arena);
+			}
+
+			if (ansr_write(ansr, input->buf, input->len) < 0 || ansr_dedup(ansr) < 0) {
+				printf("%s: input %u failed\n", bc->name, i);
+				failed = 1;
+				continue;
+			}
+
+			/* verifying is slow, so only on the first pass */
+			if (!pass && batch_verify(ansr, &conf, input) < 0) {
+				printf("%s: input %u renders differently than when fresh\n", bc->name, i);
+				failed = 1;
+			}
+		}
+
+		pass_peak[pass] = peak;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	ansr_free(ansr);
+	ansr_arena_free(arena);
+
+	/* the first pass grows everything to fit the batch, later ones must fit in that */
+	for (unsigned pass = 2; pass < BATCH_PASSES; pass++) {
+		if (pass_peak[pass] > pass_peak[1]) {
+			printf("%s: memory grew from %zu to %zu bytes on pass %u\n", bc->name, pass_peak[1], pass_peak[pass], pass);
+			failed = 1;
+		}
+	}
+
+	if (live) {
+		printf("%s: %zu bytes still allocated after freeing\n", bc->name, live);
+		failed = 1;
+	}
+
+	printf("%s: %u inputs in %.3fs, peak %zu bytes\n", bc->name, BATCH_SIZE * BATCH_PASSES,
+		(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, pass_peak[BATCH_PASSES - 1]);
+
+	return failed ? -1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	batch_conf_t	confs[] = {
+		{ "rows", { .screen_width = 80 } },
+		{ "rows/shared arena", { .screen_width = 80 }, 1 },
+		{ "presized", { .screen_width = 80, .expected_width = 80, .expected_height = 50 } },
+		{ "presized/shared arena", { .screen_width = 80, .expected_width = 80, .expected_height = 50 }, 1 },
+		{ "grid", { .screen_width = 80, .grid = 1 } },
+		{ "grid/shared arena", { .screen_width = 80, .grid = 1 }, 1 },
+		{ "sparse", { .screen_width = 80, .sparse = 1 } },
+		{ "sparse/shared arena", { .screen_width = 80, .sparse = 1 }, 1 },
+		{ "varying", {}, 0, 1 },
+		{ "varying/shared arena", {}, 1, 1 },
+	};
+	batch_input_t	inputs[BATCH_SIZE];
+	int		failed = 0;
+
+	rng = 0x9e3779b97f4a7c15ull;
+	for (unsigned i = 0; i < sizeof(glyphs); i++)
+		glyphs[i] = batch_rand(256);
+
+	for (unsigned i = 0; i < BATCH_SIZE; i++) {
+		inputs[i].buf = malloc(INPUT_MAX);
+		if (!inputs[i].buf)
+			return EXIT_FAILURE;
+
+		inputs[i].len = batch_generate(inputs[i].buf, INPUT_MAX);
+	}
+
+	for (unsigned i = 0; i < sizeof(confs) / sizeof(confs[0]); i++) {
+		if (batch_run(&confs[i], inputs) < 0)
+			failed = 1;
+	}
+
+	for (unsigned i = 0; i < BATCH_SIZE; i++)
+		free(inputs[i].buf);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,188 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* event mode test: replays the spans of generated inputs onto a canvas of
+ * its own, which must come out the same as the one ansr_new() builds from
+ * the same input, cell for cell and row width for row width.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ansr.h"
+
+#define EVENTS_INPUTS	500
+#define EVENTS_COLS	512		/* conf.max_cols/max_rows, and the replay canvas */
+#define EVENTS_ROWS	256
+#define INPUT_MAX	(16 * 1024)
+
+typedef struct events_canvas_t {
+	unsigned		height;
+	unsigned		widths[EVENTS_ROWS];
+	char			codes[EVENTS_ROWS][EVENTS_COLS];
+	ansr_disp_state_t	disp_states[EVENTS_ROWS][EVENTS_COLS];
+} events_canvas_t;
+
+static uint64_t	rng;
+
+
+static unsigned events_rand(unsigned n)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng % n;
+}
+
+
+/* generate an input of text, SGRs, cursor movement and erasures */
+static size_t events_generate(char *buf, size_t size)
+{
+	size_t	len = 0;
+
+	while (size - len > 64) {
+		switch (events_rand(12)) {
+		case 0 ... 3:
+			for (unsigned n = 1 + events_rand(30); n; n--)
+				buf[len++] = events_rand(3) ? (char)(0x20 + events_rand(0x5f)) : (char)(0xb0 + events_rand(4));
+			break;
+
+		case 4 ... 5:
+			len += sprintf(&buf[len], "\x1b[%u;%u;%um", events_rand(8), 30 + events_rand(8), 40 + events_rand(8));
+			break;
+
+		case 6:
+			len += sprintf(&buf[len], "\x1b[%uK", events_rand(3));
+			break;
+
+		case 7:
+			len += sprintf(&buf[len], "\x1b[%u%c", 1 + events_rand(60), "ABCD"[events_rand(4)]);
+			break;
+
+		case 8:
+			len += sprintf(&buf[len], "\x1b[%u;%uH", 1 + events_rand(40), 1 + events_rand(200));
+			break;
+
+		case 9:
+			len += sprintf(&buf[len], "\r\n");
+			break;
+
+		case 10:
+			buf[len++] = "\t\b\r"[events_rand(3)];
+			break;
+
+		case 11:
+			if (!events_rand(20))
+				len += sprintf(&buf[len], "\x1b[2J");
+			break;
+		}
+	}
+
+	return len;
+}
+
+
+static int events_span(void *ctx, unsigned x, unsigned y, const ansr_disp_state_t *disp_state, const char *text, char fill, size_t n)
+{
+	events_canvas_t	*canvas = ctx;
+
+	if (y >= EVENTS_ROWS || x + n > EVENTS_COLS)
+		return -1;
+
+	for (size_t i = 0; i < n; i++) {
+		canvas->codes[y][x + i] = text ? text[i] : fill;
+		canvas->disp_states[y][x + i] = *disp_state;
+	}
+
+	if (x + n > canvas->widths[y])
+		canvas->widths[y] = x + n;
+
+	if (y >= canvas->height)
+		canvas->height = y + 1;
+
+	return 0;
+}
+
+
+/* does the replayed canvas match ansr? */
+static int events_compare(ansr_t *ansr, events_canvas_t *canvas)
+{
+	if (ansr->height != canvas->height)
+		return -1;
+
+	for (unsigned y = 0; y < canvas->height; y++) {
+		unsigned	width = ansr->rows[y] ? ansr->rows[y]->width : 0;
+
+		if (width != canvas->widths[y])
+			return -1;
+
+		for (unsigned x = 0; x < width; x++) {
+			uint16_t	handle;
+			char		code;
+
+			ansr_cell(ansr, x, y, &code, &handle);
+			if (code != canvas->codes[y][x] ||
+			    memcmp(&ansr->disp_states[handle], &canvas->disp_states[y][x], sizeof(ansr_disp_state_t)))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	static events_canvas_t	canvas;
+	static char		input[INPUT_MAX];
+	unsigned		screen_widths[] = { 0, 80, 160 };
+	int			failed = 0;
+
+	rng = 0x9e3779b97f4a7c15ull;
+	for (unsigned i = 0; i < EVENTS_INPUTS; i++) {
+		size_t		len = events_generate(input, sizeof(input));
+		ansr_conf_t	conf = {
+					.screen_width = screen_widths[i % 3],
+					.max_cols = EVENTS_COLS,
+					.max_rows = EVENTS_ROWS,
+					.sparse = i % 2,
+				};
+		ansr_t		*ansr, *events;
+
+		ansr = ansr_new(&conf, input, len);
+		if (!ansr)
+			return EXIT_FAILURE;
+
+		memset(&canvas, 0, sizeof(canvas));
+		conf.events = (ansr_events_t){ .span = events_span, .ctx = &canvas };
+		events = ansr_new(&conf, input, len);
+		if (!events) {
+			printf("input %u: replaying events failed\n", i);
+			failed = 1;
+		} else if (events_compare(ansr, &canvas) < 0) {
+			printf("input %u: replayed events differ from the canvas (screen_width %u)\n", i, conf.screen_width);
+			failed = 1;
+		}
+
+		ansr_free(events);
+		ansr_free(ansr);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
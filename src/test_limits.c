@@ -0,0 +1,330 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* resource limit test: conf.max_bytes must bound everything allocated for a
+ * private arena instance, whatever the input and layout, failing writes with
+ * -ENOSPC rather than going over.  conf.max_rows/max_cols must crop the canvas
+ * to them, counting exactly the cells written outside as clipped, which an
+ * unclipped event mode instance tallies from its spans.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ansr.h"
+
+#define INPUT_MAX	(1024 * 1024)
+#define CLIP_INPUTS	200
+#define CLIP_INPUT_MAX	(16 * 1024)
+#define CLIP_MAX_ROWS	150
+
+typedef struct limits_input_t {
+	const char	*name;
+	size_t		(*generate)(char *buf, size_t size);
+} limits_input_t;
+
+typedef struct limits_clip_t {
+	unsigned	max_rows, max_cols;
+	size_t		n_clipped;		/* cells of spans outside max_rows x max_cols */
+	unsigned	height;			/* the extent of spans inside them */
+	unsigned	widths[CLIP_MAX_ROWS];
+} limits_clip_t;
+
+static size_t	live, peak;
+static uint64_t	rng;
+
+
+static unsigned limits_rand(unsigned n)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng % n;
+}
+
+
+static void * limits_malloc(void *ctx, size_t size)
+{
+	live += size;
+	if (live > peak)
+		peak = live;
+
+	return malloc(size);
+}
+
+
+static void * limits_realloc(void *ctx, void *ptr, size_t old_size, size_t size)
+{
+	live += size - old_size;
+	if (live > peak)
+		peak = live;
+
+	return realloc(ptr, size);
+}
+
+
+static void limits_free(void *ctx, void *ptr, size_t size)
+{
+	live -= size;
+	free(ptr);
+}
+
+
+/* short runs scattered far apart over many rows */
+static size_t limits_far_jumps(char *buf, size_t size)
+{
+	size_t	len = 0;
+
+	for (unsigned y = 0; y < 20000 && size - len > 64; y++)
+		len += sprintf(&buf[len], "\x1b[%u;%uH\x1b[3%um##", y + 1, 1 + (y * 7919) % 300, y % 8);
+
+	return len;
+}
+
+
+/* long lines of text */
+static size_t limits_wide_lines(char *buf, size_t size)
+{
+	size_t	len = 0;
+
+	while (size - len > 2048) {
+		for (unsigned x = 0; x < 2000; x++)
+			buf[len++] = 0x21 + x % 0x5e;
+		len += sprintf(&buf[len], "\r\n");
+	}
+
+	return len;
+}
+
+
+/* every cell in a display state of its own, as far as there are */
+static size_t limits_disp_states(char *buf, size_t size)
+{
+	size_t	len = 0;
+
+	for (unsigned i = 0; size - len > 64; i++)
+		len += sprintf(&buf[len], "\x1b[0;%u;%u;%u;%u;%um#%s", 30 + i % 8, 40 + (i / 8) % 8, 1 + (i / 64) % 9, 21 + (i / 576) % 9, 51 + (i / 5184) % 3, i % 80 ? "" : "\r\n");
+
+	return len;
+}
+
+
+/* text and cursor movement, without erasures: those span to the end of rows, which clipping shortens */
+static size_t limits_clip_generate(char *buf, size_t size)
+{
+	size_t	len = 0;
+
+	while (size - len > 128) {
+		switch (limits_rand(8)) {
+		case 0 ... 3:
+			for (unsigned n = 1 + limits_rand(80); n; n--)
+				buf[len++] = 0x20 + limits_rand(0x5f);
+			break;
+
+		case 4:
+			len += sprintf(&buf[len], "\x1b[%um", 30 + limits_rand(8));
+			break;
+
+		case 5:
+			len += sprintf(&buf[len], "\x1b[%u;%uH", 1 + limits_rand(120), 1 + limits_rand(400));
+			break;
+
+		case 6:
+			len += sprintf(&buf[len], "\x1b[%u%c", 1 + limits_rand(100), "ABCD"[limits_rand(4)]);
+			break;
+
+		case 7:
+			len += sprintf(&buf[len], "\r\n");
+			break;
+		}
+	}
+
+	return len;
+}
+
+
+/* count the cells of unclipped spans falling outside the limits, and the extent of those inside */
+static int limits_clip_span(void *ctx, unsigned x, unsigned y, const ansr_disp_state_t *disp_state, const char *text, char fill, size_t n)
+{
+	limits_clip_t	*clip = ctx;
+
+	if (y >= clip->max_rows || x >= clip->max_cols) {
+		clip->n_clipped += n;
+		return 0;
+	}
+
+	if (x + n > clip->max_cols) {
+		clip->n_clipped += x + n - clip->max_cols;
+		n = clip->max_cols - x;
+	}
+
+	if (n && x + n > clip->widths[y])
+		clip->widths[y] = x + n;
+
+	if (n && y >= clip->height)
+		clip->height = y + 1;
+
+	return 0;
+}
+
+
+/* is clipped the canvas of ansr cropped to the extent of clip? */
+static int limits_clip_compare(ansr_t *ansr, ansr_t *clipped, limits_clip_t *clip)
+{
+	if (clipped->height != clip->height)
+		return -1;
+
+	for (unsigned y = 0; y < clipped->height; y++) {
+		if ((clipped->rows[y] ? clipped->rows[y]->width : 0) != clip->widths[y])
+			return -1;
+
+		for (unsigned x = 0; x < clip->widths[y]; x++) {
+			uint16_t	handle, clipped_handle;
+			char		code, clipped_code;
+
+			ansr_cell(ansr, x, y, &code, &handle);
+			ansr_cell(clipped, x, y, &clipped_code, &clipped_handle);
+			if (code != clipped_code ||
+			    memcmp(&ansr->disp_states[handle], &clipped->disp_states[clipped_handle], sizeof(ansr_disp_state_t)))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	limits_input_t	inputs[] = {
+				{ "far jumps", limits_far_jumps },
+				{ "wide lines", limits_wide_lines },
+				{ "display states", limits_disp_states },
+			};
+	ansr_conf_t	layouts[] = {
+				{},
+				{ .sparse = 1 },
+				{ .screen_width = 300, .grid = 1 },
+				{ .expected_width = 80, .expected_height = 100 },
+			};
+	size_t		budgets[] = { 20000, 100000, 1000000, 4 * 1024 * 1024 };
+	char		*input;
+	int		failed = 0;
+
+	input = malloc(INPUT_MAX);
+	if (!input)
+		return EXIT_FAILURE;
+
+	for (unsigned i = 0; i < sizeof(inputs) / sizeof(*inputs); i++) {
+		size_t	len = inputs[i].generate(input, INPUT_MAX);
+
+		for (unsigned l = 0; l < sizeof(layouts) / sizeof(*layouts); l++) {
+			for (unsigned b = 0; b < sizeof(budgets) / sizeof(*budgets); b++) {
+				/* with and without realloc, which changes how allocations are replaced */
+				for (unsigned with_realloc = 0; with_realloc < 2; with_realloc++) {
+					ansr_conf_t	conf = layouts[l];
+					ansr_stats_t	stats;
+					ansr_t		*ansr;
+					int		r;
+
+					conf.max_bytes = budgets[b];
+					conf.allocator = (ansr_allocator_t){ limits_malloc, with_realloc ? limits_realloc : NULL, limits_free, NULL };
+					live = peak = 0;
+
+					ansr = ansr_new(&conf, NULL, 0);
+					if (!ansr) {
+						printf("%s, layout %u: ansr_new() failed with max_bytes %zu\n", inputs[i].name, l, budgets[b]);
+						failed = 1;
+						continue;
+					}
+
+					r = ansr_write(ansr, input, len);
+					ansr_stats(ansr, &stats);
+					ansr_free(ansr);
+
+					if (r < 0 && r != -ENOSPC) {
+						printf("%s, layout %u: ansr_write() failed with %i\n", inputs[i].name, l, r);
+						failed = 1;
+					}
+
+					/* none of the inputs fit the smallest budget */
+					if (!b && r != -ENOSPC) {
+						printf("%s, layout %u: ansr_write() returned %i with max_bytes %zu, not -ENOSPC\n", inputs[i].name, l, r, budgets[b]);
+						failed = 1;
+					}
+
+					if (peak > budgets[b] || stats.bytes_allocated > budgets[b]) {
+						printf("%s, layout %u: peak %zu bytes, %zu allocated, exceeds max_bytes %zu\n",
+							inputs[i].name, l, peak, stats.bytes_allocated, budgets[b]);
+						failed = 1;
+					}
+
+					if (live) {
+						printf("%s, layout %u: %zu bytes still allocated after freeing\n", inputs[i].name, l, live);
+						failed = 1;
+					}
+				}
+			}
+		}
+	}
+
+	rng = 0x9e3779b97f4a7c15ull;
+	for (unsigned i = 0; i < CLIP_INPUTS; i++) {
+		size_t		len = limits_clip_generate(input, CLIP_INPUT_MAX);
+		ansr_conf_t	conf = layouts[i % (sizeof(layouts) / sizeof(*layouts))];
+		limits_clip_t	clip = { 1 + limits_rand(CLIP_MAX_ROWS), 1 + limits_rand(500) };
+		ansr_stats_t	stats;
+		ansr_t		*ansr, *clipped, *events;
+
+		/* a grid stride of 500 holds every span, leaving the clipping to max_cols */
+		conf.screen_width = conf.grid ? 500 : limits_rand(2) * 80;
+		ansr = ansr_new(&conf, input, len);
+
+		conf.events = (ansr_events_t){ limits_clip_span, &clip };
+		events = ansr_new(&conf, input, len);
+
+		conf.events = (ansr_events_t){};
+		conf.max_rows = clip.max_rows;
+		conf.max_cols = clip.max_cols;
+		clipped = ansr_new(&conf, input, len);
+		if (!ansr || !events || !clipped)
+			return EXIT_FAILURE;
+
+		ansr_stats(clipped, &stats);
+		if (limits_clip_compare(ansr, clipped, &clip) < 0) {
+			printf("clip input %u, layout %u: the canvas isn't cropped to max_rows %u, max_cols %u\n",
+				i, i % (unsigned)(sizeof(layouts) / sizeof(*layouts)), clip.max_rows, clip.max_cols);
+			failed = 1;
+		}
+
+		if (stats.cells_clipped != clip.n_clipped) {
+			printf("clip input %u: %zu cells clipped, expected %zu\n", i, stats.cells_clipped, clip.n_clipped);
+			failed = 1;
+		}
+
+		ansr_free(clipped);
+		ansr_free(events);
+		ansr_free(ansr);
+	}
+
+	free(input);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
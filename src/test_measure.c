@@ -0,0 +1,199 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* measure test: ansr_measure() must give the extent ansr_new() leaves the
+ * canvas of the same input and conf at, the widest row and the height, while
+ * allocating nothing but its parser state.  ansr_new() with conf.measure
+ * laying the canvas out from that must build the same canvas as without.
+ * conf.grid only clips rows to its stride, which the measured extent widens
+ * to hold them all, so grid confs are compared to the rows layout.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ansr.h"
+
+#define MEASURE_INPUTS	300
+#define INPUT_MAX	(16 * 1024)
+
+static uint64_t	rng;
+static size_t	n_allocs;
+
+
+static unsigned measure_rand(unsigned n)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng % n;
+}
+
+
+static void * measure_malloc(void *ctx, size_t size)
+{
+	n_allocs++;
+
+	return malloc(size);
+}
+
+
+static void measure_free(void *ctx, void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+
+/* generate an input of text, SGRs, cursor movement and erasures */
+static size_t measure_generate(char *buf, size_t size)
+{
+	size_t	len = 0;
+
+	while (size - len > 64) {
+		switch (measure_rand(12)) {
+		case 0 ... 3:
+			for (unsigned n = 1 + measure_rand(60); n; n--)
+				buf[len++] = measure_rand(3) ? (char)(0x20 + measure_rand(0x5f)) : (char)(0xb0 + measure_rand(4));
+			break;
+
+		case 4:
+			len += sprintf(&buf[len], "\x1b[%u;%um", 30 + measure_rand(8), 40 + measure_rand(8));
+			break;
+
+		case 5:
+			len += sprintf(&buf[len], "\x1b[%uK", measure_rand(3));
+			break;
+
+		case 6:
+			len += sprintf(&buf[len], "\x1b[%u%c", 1 + measure_rand(100), "ABCD"[measure_rand(4)]);
+			break;
+
+		case 7:
+			len += sprintf(&buf[len], "\x1b[%u;%uH", 1 + measure_rand(80), 1 + measure_rand(300));
+			break;
+
+		case 8:
+			len += sprintf(&buf[len], "\x1b[s\x1b[%uB\x1b[u", 1 + measure_rand(50));
+			break;
+
+		case 9:
+			len += sprintf(&buf[len], "\r\n");
+			break;
+
+		case 10:
+			buf[len++] = "\t\b\r\n"[measure_rand(4)];
+			break;
+
+		case 11:
+			if (!measure_rand(20))
+				len += sprintf(&buf[len], "\x1b[2J");
+			break;
+		}
+	}
+
+	return len;
+}
+
+
+/* do a and b have the same cells, in the same display states? */
+static int measure_compare(ansr_t *a, ansr_t *b)
+{
+	if (a->height != b->height)
+		return -1;
+
+	for (unsigned y = 0; y < a->height; y++) {
+		unsigned	width = a->rows[y] ? a->rows[y]->width : 0;
+
+		if (width != (b->rows[y] ? b->rows[y]->width : 0))
+			return -1;
+
+		for (unsigned x = 0; x < width; x++) {
+			uint16_t	a_handle, b_handle;
+			char		a_code, b_code;
+
+			ansr_cell(a, x, y, &a_code, &a_handle);
+			ansr_cell(b, x, y, &b_code, &b_handle);
+			if (a_code != b_code ||
+			    memcmp(&a->disp_states[a_handle], &b->disp_states[b_handle], sizeof(ansr_disp_state_t)))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	static char	input[INPUT_MAX];
+	ansr_conf_t	confs[] = {
+				{},
+				{ .screen_width = 80 },
+				{ .screen_width = 160, .sparse = 1 },
+				{ .screen_width = 80, .grid = 1 },
+				{ .screen_width = 80, .max_cols = 60, .max_rows = 40 },
+				{ .max_cols = 200 },
+			};
+	int		failed = 0;
+
+	rng = 0x9e3779b97f4a7c15ull;
+	for (unsigned i = 0; i < MEASURE_INPUTS; i++) {
+		size_t		len = measure_generate(input, sizeof(input));
+		ansr_conf_t	conf = confs[i % (sizeof(confs) / sizeof(*confs))], rows_conf = conf;
+		unsigned	width, height, widest = 0;
+		ansr_t		*ansr, *measured;
+		int		r;
+
+		rows_conf.grid = 0;
+		ansr = ansr_new(&rows_conf, input, len);
+		if (!ansr)
+			return EXIT_FAILURE;
+
+		for (unsigned y = 0; y < ansr->height; y++) {
+			if (ansr->rows[y] && ansr->rows[y]->width > widest)
+				widest = ansr->rows[y]->width;
+		}
+
+		conf.allocator = (ansr_allocator_t){ measure_malloc, NULL, measure_free, NULL };
+		n_allocs = 0;
+		r = ansr_measure(&conf, input, len, &width, &height);
+		if (r < 0) {
+			printf("input %u: ansr_measure() failed with %i\n", i, r);
+			failed = 1;
+		} else if (width != widest || height != ansr->height) {
+			printf("input %u: measured %ux%u, ansr_new() left %ux%u\n", i, width, height, widest, ansr->height);
+			failed = 1;
+		} else if (n_allocs != 1) {
+			printf("input %u: ansr_measure() made %zu allocations\n", i, n_allocs);
+			failed = 1;
+		}
+
+		conf.measure = 1;
+		measured = ansr_new(&conf, input, len);
+		if (!measured || measure_compare(ansr, measured) < 0) {
+			printf("input %u: conf.measure changed the canvas\n", i);
+			failed = 1;
+		}
+
+		ansr_free(measured);
+		ansr_free(ansr);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
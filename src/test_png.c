@@ -0,0 +1,645 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* PNG encoder test: encodes rendered canvases (and some synthetic images)
+ * with ansr_png, then decodes the result independently of the encoder:
+ * checks the signature, chunk layout and CRCs, inflates the IDAT stream,
+ * checks its Adler-32, unfilters the rows and compares the color indices
+ * to those ansr_render_rgba() renders.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ansr.h"
+#include "ansr_png.h"
+#include "ansr_render.h"
+
+#define INPUT_MAX	(32 * 1024)
+
+typedef struct png_buf_t {
+	uint8_t		*data;
+	size_t		len, size;
+} png_buf_t;
+
+/* inflate state, bits are read least significant first */
+typedef struct png_inflate_t {
+	const uint8_t	*in;
+	size_t		in_len, in_pos;
+	uint32_t	bits;
+	unsigned	n_bits;
+	uint8_t		*out;
+	size_t		out_len, out_size;
+} png_inflate_t;
+
+/* canonical huffman decoding table: symbol counts per length, symbols by code */
+typedef struct png_huffman_t {
+	uint16_t	counts[16];
+	uint16_t	symbols[288];
+} png_huffman_t;
+
+static uint64_t	rng;
+static uint8_t	glyphs[256 * 16];
+
+
+static unsigned png_rand(unsigned n)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng % n;
+}
+
+
+static int png_write(void *ctx, const void *buf, size_t len)
+{
+	png_buf_t	*out = ctx;
+
+	if (out->len + len > out->size) {
+		size_t	size = (out->len + len) * 2;
+		uint8_t	*new;
+
+		new = realloc(out->data, size);
+		if (!new)
+			return -1;
+
+		out->data = new;
+		out->size = size;
+	}
+
+	memcpy(&out->data[out->len], buf, len);
+	out->len += len;
+
+	return 0;
+}
+
+
+static uint32_t png_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+
+/* bitwise, so it shares nothing with the encoder's table */
+static uint32_t png_crc(const uint8_t *buf, size_t len)
+{
+	uint32_t	crc = ~0U;
+
+	for (size_t i = 0; i < len; i++) {
+		crc ^= buf[i];
+		for (unsigned k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+	}
+
+	return ~crc;
+}
+
+
+static uint32_t png_adler(const uint8_t *buf, size_t len)
+{
+	uint32_t	a = 1, b = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		a = (a + buf[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	return b << 16 | a;
+}
+
+
+static int png_inflate_bits(png_inflate_t *s, unsigned n, unsigned *res)
+{
+	while (s->n_bits < n) {
+		if (s->in_pos == s->in_len)
+			return -1;
+
+		s->bits |= (uint32_t)s->in[s->in_pos++] << s->n_bits;
+		s->n_bits += 8;
+	}
+
+	*res = s->bits & ((1U << n) - 1);
+	s->bits >>= n;
+	s->n_bits -= n;
+
+	return 0;
+}
+
+
+static int png_inflate_byte(png_inflate_t *s, uint8_t b)
+{
+	if (s->out_len == s->out_size)
+		return -1;
+
+	s->out[s->out_len++] = b;
+
+	return 0;
+}
+
+
+static int png_huffman_build(png_huffman_t *h, const uint8_t *lens, unsigned n)
+{
+	uint16_t	offsets[16];
+
+	memset(h->counts, 0, sizeof(h->counts));
+	for (unsigned i = 0; i < n; i++)
+		h->counts[lens[i]]++;
+	h->counts[0] = 0;
+
+	offsets[1] = 0;
+	for (unsigned l = 1; l < 15; l++)
+		offsets[l + 1] = offsets[l] + h->counts[l];
+
+	for (unsigned i = 0; i < n; i++) {
+		if (lens[i])
+			h->symbols[offsets[lens[i]]++] = i;
+	}
+
+	return 0;
+}
+
+
+static int png_huffman_decode(png_inflate_t *s, const png_huffman_t *h, unsigned *res)
+{
+	int	code = 0, first = 0, index = 0;
+
+	for (unsigned l = 1; l < 16; l++) {
+		unsigned	bit;
+		int		count = h->counts[l];
+
+		if (png_inflate_bits(s, 1, &bit) < 0)
+			return -1;
+
+		code |= bit;
+		if (code - count < first) {
+			*res = h->symbols[index + (code - first)];
+			return 0;
+		}
+
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+
+static int png_inflate_codes(png_inflate_t *s, const png_huffman_t *lit, const png_huffman_t *dist)
+{
+	static const uint16_t	len_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const uint8_t	len_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const uint16_t	dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const uint8_t	dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	for (;;) {
+		unsigned	sym, len, d, extra;
+
+		if (png_huffman_decode(s, lit, &sym) < 0)
+			return -1;
+
+		if (sym < 256) {
+			if (png_inflate_byte(s, sym) < 0)
+				return -1;
+			continue;
+		}
+
+		if (sym == 256)
+			return 0;
+
+		sym -= 257;
+		if (sym >= 29 || png_inflate_bits(s, len_extra[sym], &extra) < 0)
+			return -1;
+		len = len_base[sym] + extra;
+
+		if (png_huffman_decode(s, dist, &sym) < 0 || sym >= 30 || png_inflate_bits(s, dist_extra[sym], &extra) < 0)
+			return -1;
+		d = dist_base[sym] + extra;
+
+		if (d > s->out_len || d > 32768)
+			return -1;
+
+		for (unsigned i = 0; i < len; i++) {
+			if (png_inflate_byte(s, s->out[s->out_len - d]) < 0)
+				return -1;
+		}
+	}
+}
+
+
+/* inflate a zlib stream into out, all of deflate's block types are handled */
+static int png_inflate(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size, size_t *res_len)
+{
+	png_inflate_t	s = { .in = in, .in_len = in_len, .out = out, .out_size = out_size };
+	unsigned	final;
+
+	if (in_len < 6 || (in[0] & 0xf) != 8 || (in[0] >> 4) > 7 || (in[0] << 8 | in[1]) % 31 || in[1] & 0x20)
+		return -1;
+	s.in_pos = 2;
+
+	do {
+		unsigned	type;
+
+		if (png_inflate_bits(&s, 1, &final) < 0 || png_inflate_bits(&s, 2, &type) < 0)
+			return -1;
+
+		if (type == 0) {		/* stored */
+			size_t	len;
+
+			s.bits = s.n_bits = 0;
+			if (s.in_len - s.in_pos < 4)
+				return -1;
+
+			len = s.in[s.in_pos] | s.in[s.in_pos + 1] << 8;
+			if ((len ^ 0xffff) != (unsigned)(s.in[s.in_pos + 2] | s.in[s.in_pos + 3] << 8))
+				return -1;
+
+			s.in_pos += 4;
+			if (s.in_len - s.in_pos < len)
+				return -1;
+
+			for (size_t i = 0; i < len; i++) {
+				if (png_inflate_byte(&s, s.in[s.in_pos++]) < 0)
+					return -1;
+			}
+		} else if (type == 1) {		/* fixed huffman */
+			png_huffman_t	lit, dist;
+			uint8_t		lens[288];
+
+			memset(lens, 8, 144);
+			memset(&lens[144], 9, 112);
+			memset(&lens[256], 7, 24);
+			memset(&lens[280], 8, 8);
+			png_huffman_build(&lit, lens, 288);
+			memset(lens, 5, 30);
+			png_huffman_build(&dist, lens, 30);
+
+			if (png_inflate_codes(&s, &lit, &dist) < 0)
+				return -1;
+		} else if (type == 2) {		/* dynamic huffman */
+			static const uint8_t	order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+			png_huffman_t		lit, dist, clen;
+			unsigned		n_lit, n_dist, n_clen;
+			uint8_t			lens[320] = {};
+
+			if (png_inflate_bits(&s, 5, &n_lit) < 0 || png_inflate_bits(&s, 5, &n_dist) < 0 || png_inflate_bits(&s, 4, &n_clen) < 0)
+				return -1;
+			n_lit += 257;
+			n_dist += 1;
+			n_clen += 4;
+
+			for (unsigned i = 0; i < n_clen; i++) {
+				unsigned	l;
+
+				if (png_inflate_bits(&s, 3, &l) < 0)
+					return -1;
+				lens[order[i]] = l;
+			}
+			png_huffman_build(&clen, lens, 19);
+
+			memset(lens, 0, sizeof(lens));
+			for (unsigned i = 0; i < n_lit + n_dist;) {
+				unsigned	sym, rep, v = 0;
+
+				if (png_huffman_decode(&s, &clen, &sym) < 0)
+					return -1;
+
+				if (sym < 16) {
+					lens[i++] = sym;
+					continue;
+				}
+
+				if (sym == 16) {
+					if (!i || png_inflate_bits(&s, 2, &rep) < 0)
+						return -1;
+					v = lens[i - 1];
+					rep += 3;
+				} else if (sym == 17) {
+					if (png_inflate_bits(&s, 3, &rep) < 0)
+						return -1;
+					rep += 3;
+				} else {
+					if (png_inflate_bits(&s, 7, &rep) < 0)
+						return -1;
+					rep += 11;
+				}
+
+				if (i + rep > n_lit + n_dist)
+					return -1;
+
+				while (rep--)
+					lens[i++] = v;
+			}
+
+			png_huffman_build(&lit, lens, n_lit);
+			png_huffman_build(&dist, &lens[n_lit], n_dist);
+			if (png_inflate_codes(&s, &lit, &dist) < 0)
+				return -1;
+		} else {
+			return -1;
+		}
+	} while (!final);
+
+	/* the adler-32 of the inflated data follows, byte aligned */
+	s.bits = s.n_bits = 0;
+	if (s.in_len - s.in_pos != 4 || png_be32(&s.in[s.in_pos]) != png_adler(out, s.out_len))
+		return -1;
+
+	*res_len = s.out_len;
+
+	return 0;
+}
+
+
+static uint8_t png_paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+	int	p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+	if (pa <= pb && pa <= pc)
+		return a;
+
+	return pb <= pc ? b : c;
+}
+
+
+/* decode png, checking it's a width x height image of palette whose indices match pixels */
+static int png_check(const png_buf_t *png, unsigned width, unsigned height, const uint32_t *palette, const uint32_t *pixels)
+{
+	uint8_t		*idat = NULL, *raw = NULL;
+	size_t		idat_len = 0, raw_len, pos = 8;
+	int		seen_ihdr = 0, seen_plte = 0, seen_iend = 0, r = -1;
+
+	if (png->len < 8 || memcmp(png->data, "\x89PNG\r\n\x1a\n", 8)) {
+		printf("bad signature\n");
+		return -1;
+	}
+
+	while (pos < png->len) {
+		const uint8_t	*chunk = &png->data[pos];
+		uint32_t	len;
+
+		if (png->len - pos < 12 || (len = png_be32(chunk)) > png->len - pos - 12) {
+			printf("truncated chunk at %zu\n", pos);
+			goto _out;
+		}
+
+		if (png_crc(&chunk[4], 4 + len) != png_be32(&chunk[8 + len])) {
+			printf("bad crc in %.4s chunk at %zu\n", &chunk[4], pos);
+			goto _out;
+		}
+
+		if (seen_iend) {
+			printf("chunks after IEND\n");
+			goto _out;
+		}
+
+		if (!memcmp(&chunk[4], "IHDR", 4)) {
+			static const uint8_t	rest[5] = { 8, 3, 0, 0, 0 };
+
+			if (pos != 8 || len != 13 || png_be32(&chunk[8]) != width || png_be32(&chunk[12]) != height || memcmp(&chunk[16], rest, 5)) {
+				printf("bad IHDR\n");
+				goto _out;
+			}
+			seen_ihdr = 1;
+		} else if (!memcmp(&chunk[4], "PLTE", 4)) {
+			if (!seen_ihdr || idat_len || len != 16 * 3) {
+				printf("bad PLTE\n");
+				goto _out;
+			}
+
+			for (unsigned i = 0; i < 16; i++) {
+				if (memcmp(&chunk[8 + i * 3], &palette[i], 3)) {
+					printf("PLTE entry %u differs from the palette\n", i);
+					goto _out;
+				}
+			}
+			seen_plte = 1;
+		} else if (!memcmp(&chunk[4], "IDAT", 4)) {
+			uint8_t	*new;
+
+			if (!seen_plte) {
+				printf("IDAT before PLTE\n");
+				goto _out;
+			}
+
+			new = realloc(idat, idat_len + len);
+			if (!new)
+				goto _out;
+
+			idat = new;
+			memcpy(&idat[idat_len], &chunk[8], len);
+			idat_len += len;
+		} else if (!memcmp(&chunk[4], "IEND", 4)) {
+			if (len) {
+				printf("bad IEND\n");
+				goto _out;
+			}
+			seen_iend = 1;
+		} else {
+			printf("unexpected %.4s chunk\n", &chunk[4]);
+			goto _out;
+		}
+
+		pos += 12 + len;
+	}
+
+	if (!seen_iend || !idat_len) {
+		printf("missing IDAT or IEND\n");
+		goto _out;
+	}
+
+	raw = malloc((size_t)(width + 1) * height + 1);
+	if (!raw)
+		goto _out;
+
+	if (png_inflate(idat, idat_len, raw, (size_t)(width + 1) * height + 1, &raw_len) < 0) {
+		printf("IDAT doesn't inflate, or its adler-32 is wrong\n");
+		goto _out;
+	}
+
+	if (raw_len != (size_t)(width + 1) * height) {
+		printf("inflated %zu bytes, expected %zu\n", raw_len, (size_t)(width + 1) * height);
+		goto _out;
+	}
+
+	for (unsigned y = 0; y < height; y++) {
+		uint8_t		*row = &raw[(size_t)y * (width + 1)], *prev = y ? row - (width + 1) : NULL;
+
+		for (unsigned x = 1; x <= width; x++) {
+			uint8_t	a = x > 1 ? row[x - 1] : 0, b = prev ? prev[x] : 0, c = prev && x > 1 ? prev[x - 1] : 0;
+
+			switch (row[0]) {
+			case 0:
+				break;
+			case 1:
+				row[x] += a;
+				break;
+			case 2:
+				row[x] += b;
+				break;
+			case 3:
+				row[x] += (a + b) / 2;
+				break;
+			case 4:
+				row[x] += png_paeth(a, b, c);
+				break;
+			default:
+				printf("bad filter type %u on row %u\n", row[0], y);
+				goto _out;
+			}
+
+			if (row[x] != pixels[(size_t)y * width + x - 1]) {
+				printf("pixel %u,%u is %u, expected %u\n", x - 1, y, row[x], pixels[(size_t)y * width + x - 1]);
+				goto _out;
+			}
+		}
+	}
+
+	r = 0;
+
+_out:
+	free(idat);
+	free(raw);
+
+	return r;
+}
+
+
+/* encode the width x height indices at pixels in strips of up to strip_rows */
+static int png_encode(png_buf_t *out, const uint32_t *pixels, unsigned width, unsigned height, unsigned strip_rows)
+{
+	ansr_png_t	*png;
+	int		r = 0;
+
+	png = ansr_png_new(NULL, width, height, ansr_palette_vga, png_write, out);
+	if (!png)
+		return -1;
+
+	for (unsigned y = 0; y < height && r >= 0; y += strip_rows)
+		r = ansr_png_strip(png, &pixels[(size_t)y * width], y, height - y < strip_rows ? height - y : strip_rows, width);
+
+	ansr_png_free(png);
+
+	return r;
+}
+
+
+/* generate an input of SGR-colored text and cursor movement */
+static size_t png_generate(char *buf, size_t size)
+{
+	size_t	len = 0;
+
+	for (unsigned lines = 1 + png_rand(60); lines && size - len > 1024; lines--) {
+		for (unsigned n = png_rand(16); n; n--) {
+			len += sprintf(&buf[len], "\x1b[%u;%u;%um", png_rand(2), 30 + png_rand(8), 40 + png_rand(8));
+			if (!png_rand(4))
+				len += sprintf(&buf[len], "\x1b[%uC", 1 + png_rand(30));
+
+			for (unsigned k = 1 + png_rand(10); k; k--)
+				buf[len++] = png_rand(2) ? (char)(0xb0 + png_rand(4)) : (char)(0x20 + png_rand(0x5f));
+		}
+		len += sprintf(&buf[len], "\r\n");
+	}
+
+	return len;
+}
+
+
+int main(int argc, char *argv[])
+{
+	ansr_font_t	font = { 16, glyphs };
+	static char	input[INPUT_MAX];
+	int		failed = 0;
+
+	rng = 0x9e3779b97f4a7c15ull;
+	for (unsigned i = 0; i < sizeof(glyphs); i++)
+		glyphs[i] = png_rand(4) ? 0 : png_rand(256);
+
+	/* rendered canvases, through ansr_render_strips() as intended */
+	for (unsigned i = 0; i < 40; i++) {
+		ansr_conf_t		conf = { .screen_width = 80 };
+		unsigned		width = 1 + png_rand(800), height = 1 + png_rand(1000), strip_rows = 1 + png_rand(4);
+		uint32_t		*pixels, *strip;
+		ansr_glyph_cache_t	*cache;
+		png_buf_t		out = {};
+		ansr_png_t		*png;
+		ansr_t			*ansr;
+		int			r;
+
+		ansr = ansr_new(&conf, input, png_generate(input, sizeof(input)));
+		pixels = malloc((size_t)width * height * sizeof(*pixels));
+		strip = malloc((size_t)width * font.height * strip_rows * sizeof(*strip));
+		cache = ansr_glyph_cache_new(NULL, &font, ansr_palette_indices, 0);
+		png = ansr_png_new(NULL, width, height, ansr_palette_vga, png_write, &out);
+		if (!ansr || !pixels || !strip || !cache || !png)
+			return EXIT_FAILURE;
+
+		r = ansr_render_rgba(ansr, &font, ansr_palette_indices, pixels, width, height, width);
+		if (r >= 0)
+			r = ansr_render_strips(ansr, cache, width, height, strip, strip_rows, ansr_png_strip, png);
+
+		if (r < 0 || png_check(&out, width, height, ansr_palette_vga, pixels) < 0) {
+			printf("canvas %u (%ux%u) failed\n", i, width, height);
+			failed = 1;
+		}
+
+		ansr_png_free(png);
+		ansr_glyph_cache_free(cache);
+		free(strip);
+		free(pixels);
+		free(out.data);
+		ansr_free(ansr);
+	}
+
+	/* synthetic images: noise, long runs and far repeats, for the matcher and window sliding */
+	for (unsigned i = 0; i < 12; i++) {
+		unsigned	width = 1 + png_rand(1200), height = 1 + png_rand(400);
+		png_buf_t	out = {};
+		uint32_t	*pixels;
+
+		pixels = malloc((size_t)width * height * sizeof(*pixels));
+		if (!pixels)
+			return EXIT_FAILURE;
+
+		for (size_t p = 0; p < (size_t)width * height; p++) {
+			switch (i % 3) {
+			case 0:
+				pixels[p] = png_rand(16);
+				break;
+			case 1:
+				pixels[p] = p && png_rand(50) ? pixels[p - 1] : png_rand(16);
+				break;
+			case 2:
+				pixels[p] = p >= 20000 && png_rand(8) ? pixels[p - 20000 + png_rand(3)] : png_rand(16);
+				break;
+			}
+		}
+
+		if (png_encode(&out, pixels, width, height, 1 + png_rand(64)) < 0 ||
+		    png_check(&out, width, height, ansr_palette_vga, pixels) < 0) {
+			printf("image %u (%ux%u) failed\n", i, width, height);
+			failed = 1;
+		}
+
+		free(pixels);
+		free(out.data);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* render test: every other way of rendering a canvas must produce exactly
+ * the pixels ansr_render_rgba() does, for any layout, font, pixel extent
+ * and pitch, leaving the pixels past the width in each pitch untouched.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ansr.h"
+#include "ansr_render.h"
+
+#define RENDER_INPUTS	60
+#define INPUT_MAX	(8 * 1024)
+#define RENDER_JUNK	0xa5a5a5a5
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+
+typedef struct render_t {
+	const char	*name;
+	int		(*func)(ansr_t *ansr, const ansr_font_t *font, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch);
+} render_t;
+
+typedef struct render_strips_t {
+	uint32_t	*pixels;
+	unsigned	width, pitch, max_height;
+	unsigned	next_y;			/* strips must come in order, without gaps */
+} render_strips_t;
+
+static uint64_t	rng;
+static unsigned	max_tiles;
+
+
+static unsigned render_rand(unsigned n)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng % n;
+}
+
+
+/* generate an input of colored text with attributes, cursor movement and erasures */
+static size_t render_generate(char *buf, size_t size)
+{
+	size_t	len = 0;
+
+	while (size - len > 64) {
+		switch (render_rand(10)) {
+		case 0 ... 4:
+			for (unsigned n = 1 + render_rand(20); n; n--)
+				buf[len++] = render_rand(3) ? (char)(0x20 + render_rand(0x5f)) : (char)(0xb0 + render_rand(4));
+			break;
+
+		case 5 ... 6:
+			len += sprintf(&buf[len], "\x1b[%u;%u;%um", "0157"[render_rand(4)] - '0', 30 + render_rand(8), 40 + render_rand(8));
+			break;
+
+		case 7:
+			len += sprintf(&buf[len], "\x1b[%u;%uH", 1 + render_rand(50), 1 + render_rand(120));
+			break;
+
+		case 8:
+			len += sprintf(&buf[len], "\x1b[%uK", render_rand(3));
+			break;
+
+		case 9:
+			len += sprintf(&buf[len], "\r\n");
+			break;
+		}
+	}
+
+	return len;
+}
+
+
+static int render_cached(ansr_t *ansr, const ansr_font_t *font, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch)
+{
+	ansr_glyph_cache_stats_t	stats;
+	ansr_glyph_cache_t		*cache;
+	int				r;
+
+	cache = ansr_glyph_cache_new(NULL, font, ansr_palette_vga, max_tiles);
+	if (!cache)
+		return -1;
+
+	r = ansr_render_rgba_cached(ansr, cache, pixels, width, height, pitch);
+	ansr_glyph_cache_stats(cache, &stats);
+	ansr_glyph_cache_free(cache);
+
+	if (stats.tiles > stats.max_tiles || (max_tiles && stats.max_tiles != max_tiles))
+		return -1;
+
+	return r;
+}
+
+
+/* copy a strip into place, checking it follows the last one */
+static int render_strip(void *ctx, const uint32_t *pixels, unsigned y, unsigned height, unsigned pitch)
+{
+	render_strips_t	*strips = ctx;
+
+	if (y != strips->next_y || !height || height > strips->max_height || pitch != strips->width)
+		return -1;
+
+	for (unsigned r = 0; r < height; r++)
+		memcpy(&strips->pixels[(size_t)(y + r) * strips->pitch], &pixels[(size_t)r * pitch], strips->width * sizeof(*pixels));
+
+	strips->next_y = y + height;
+
+	return 0;
+}
+
+
+static int render_strips(ansr_t *ansr, const ansr_font_t *font, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch)
+{
+	unsigned		strip_rows = 1 + render_rand(5);
+	render_strips_t		strips = { pixels, width, pitch, strip_rows * font->height };
+	ansr_glyph_cache_t	*cache;
+	uint32_t		*strip;
+	int			r = -1;
+
+	cache = ansr_glyph_cache_new(NULL, font, ansr_palette_vga, max_tiles);
+	strip = malloc((size_t)width * strip_rows * font->height * sizeof(*strip));
+	if (cache && strip)
+		r = ansr_render_strips(ansr, cache, width, height, strip, strip_rows, render_strip, &strips);
+
+	free(strip);
+	ansr_glyph_cache_free(cache);
+
+	if (r < 0 || strips.next_y != height)
+		return -1;
+
+	return 0;
+}
+
+
+static int render_threaded(ansr_t *ansr, const ansr_font_t *font, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch)
+{
+	unsigned	n_threads[] = { 0, 1, 2, 3, 7, ANSR_RENDER_MAX_THREADS, 1000 };
+
+	return ansr_render_rgba_threaded(ansr, font, ansr_palette_vga, pixels, width, height, pitch, n_threads[render_rand(sizeof(n_threads) / sizeof(*n_threads))]);
+}
+
+
+/* text rows in randomly sized bands, bottom up, past the last row included */
+static int render_rows(ansr_t *ansr, const ansr_font_t *font, uint32_t *pixels, unsigned width, unsigned height, unsigned pitch)
+{
+	unsigned	rows = (height + font->height - 1) / font->height;
+
+	for (unsigned last_row = rows + 2; last_row;) {
+		unsigned	n_rows = 1 + render_rand(MIN(last_row, 9));
+
+		last_row -= n_rows;
+		if (ansr_render_rgba_rows(ansr, font, ansr_palette_vga, pixels, width, height, pitch, last_row, n_rows) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	render_t	renders[] = {
+				{ "cached", render_cached },
+				{ "strips", render_strips },
+				{ "threaded", render_threaded },
+				{ "rows", render_rows },
+			};
+	ansr_conf_t	confs[] = {
+				{ .screen_width = 80 },
+				{ .screen_width = 80, .sparse = 1 },
+				{ .screen_width = 100, .grid = 1 },
+			};
+	unsigned	tiles[] = { 0, 1, 7, 64 };
+	static uint8_t	glyphs[256 * 16];
+	static char	input[INPUT_MAX];
+	int		failed = 0;
+
+	rng = 0x9e3779b97f4a7c15ull;
+	for (unsigned i = 0; i < sizeof(glyphs); i++)
+		glyphs[i] = render_rand(256);
+
+	for (unsigned i = 0; i < RENDER_INPUTS; i++) {
+		ansr_conf_t	conf = confs[i % (sizeof(confs) / sizeof(*confs))];
+		ansr_font_t	font = { render_rand(2) ? 16 : 8, glyphs };
+		unsigned	width = 1 + render_rand(1000), height = 1 + render_rand(800), pitch = width + render_rand(3) * 7;
+		size_t		n_pixels = (size_t)pitch * height;
+		uint32_t	*expected, *pixels;
+		ansr_t		*ansr;
+
+		ansr = ansr_new(&conf, input, render_generate(input, sizeof(input)));
+		expected = malloc(n_pixels * sizeof(*expected));
+		pixels = malloc(n_pixels * sizeof(*pixels));
+		if (!ansr || !expected || !pixels)
+			return EXIT_FAILURE;
+
+		if (i % 4 == 3 && ansr_dedup(ansr) < 0)
+			return EXIT_FAILURE;
+
+		for (size_t p = 0; p < n_pixels; p++)
+			expected[p] = RENDER_JUNK;
+
+		if (ansr_render_rgba(ansr, &font, ansr_palette_vga, expected, width, height, pitch) < 0)
+			return EXIT_FAILURE;
+
+		max_tiles = tiles[i % (sizeof(tiles) / sizeof(*tiles))];
+		for (unsigned r = 0; r < sizeof(renders) / sizeof(*renders); r++) {
+			for (size_t p = 0; p < n_pixels; p++)
+				pixels[p] = RENDER_JUNK;
+
+			if (renders[r].func(ansr, &font, pixels, width, height, pitch) < 0) {
+				printf("input %u: %s render failed\n", i, renders[r].name);
+				failed = 1;
+			} else if (memcmp(pixels, expected, n_pixels * sizeof(*pixels))) {
+				printf("input %u: %s render of %ux%u (pitch %u, font height %u) differs\n",
+					i, renders[r].name, width, height, pitch, font.height);
+				failed = 1;
+			}
+		}
+
+		free(pixels);
+		free(expected);
+		ansr_free(ansr);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
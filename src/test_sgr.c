@@ -0,0 +1,248 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* SGR cache test: the cache must count its hits and misses exactly, and
+ * never change what's rendered.  SGR params only ever assign, so repeating
+ * a sequence's params has the same effect as the sequence, and repeating
+ * them past the longest cached param list gives an input the cache is
+ * bypassed for, which must come out the same as the cached original.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ansr.h"
+
+#define SGR_INPUTS		200
+#define SGR_POOL		48	/* distinct sequences per input */
+#define SGR_CACHE_PARAMS	8	/* ANSR_SGR_CACHE_PARAMS */
+#define INPUT_MAX		(16 * 1024)
+
+typedef struct sgr_seq_t {
+	unsigned	n_params;
+	unsigned	params[SGR_CACHE_PARAMS];
+} sgr_seq_t;
+
+static uint64_t	rng;
+
+
+static unsigned sgr_rand(unsigned n)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng % n;
+}
+
+
+/* a sequence of up to SGR_CACHE_PARAMS supported params */
+static void sgr_seq(sgr_seq_t *seq)
+{
+	static const unsigned	params[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 21, 22, 23, 24, 25, 26, 27, 28, 29, 39, 49, 50 };
+
+	seq->n_params = 0;
+	for (unsigned n = 1 + sgr_rand(4); n && seq->n_params < SGR_CACHE_PARAMS - 2; n--) {
+		switch (sgr_rand(4)) {
+		case 0:
+			seq->params[seq->n_params++] = params[sgr_rand(sizeof(params) / sizeof(*params))];
+			break;
+		case 1:
+			seq->params[seq->n_params++] = 30 + sgr_rand(8);
+			break;
+		case 2:
+			seq->params[seq->n_params++] = 40 + sgr_rand(8);
+			break;
+		case 3:
+			seq->params[seq->n_params++] = sgr_rand(2) ? 38 : 48;
+			seq->params[seq->n_params++] = 5;
+			seq->params[seq->n_params++] = sgr_rand(16);
+			break;
+		}
+	}
+}
+
+
+/* print seq repeated to over SGR_CACHE_PARAMS params when uncached */
+static size_t sgr_print(char *buf, const sgr_seq_t *seq, int uncached)
+{
+	unsigned	repeats = uncached ? SGR_CACHE_PARAMS / seq->n_params + 1 : 1;
+	size_t		len = 2;
+
+	memcpy(buf, "\x1b[", 2);
+	for (unsigned r = 0; r < repeats; r++) {
+		for (unsigned i = 0; i < seq->n_params; i++)
+			len += sprintf(&buf[len], "%s%u", r || i ? ";" : "", seq->params[i]);
+	}
+	buf[len++] = 'm';
+
+	return len;
+}
+
+
+/* generate the cached and uncached forms of an input of text colored by sequences from a pool */
+static void sgr_generate(char *cached, size_t *res_cached_len, char *uncached, size_t *res_uncached_len, unsigned *res_n_sgrs)
+{
+	sgr_seq_t	pool[SGR_POOL];
+	size_t		cached_len = 0, uncached_len = 0;
+	unsigned	n_sgrs = 0;
+
+	for (unsigned i = 0; i < SGR_POOL; i++)
+		sgr_seq(&pool[i]);
+
+	while (INPUT_MAX - uncached_len > 256) {
+		unsigned	p = sgr_rand(SGR_POOL);
+
+		if (!sgr_rand(20)) {
+			cached_len += sprintf(&cached[cached_len], "\r\n");
+			uncached_len += sprintf(&uncached[uncached_len], "\r\n");
+		}
+
+		cached_len += sgr_print(&cached[cached_len], &pool[p], 0);
+		uncached_len += sgr_print(&uncached[uncached_len], &pool[p], 1);
+		n_sgrs++;
+
+		for (unsigned n = 1 + sgr_rand(6); n; n--) {
+			char	c = sgr_rand(3) ? (char)(0x20 + sgr_rand(0x5f)) : (char)(0xb0 + sgr_rand(4));
+
+			cached[cached_len++] = c;
+			uncached[uncached_len++] = c;
+		}
+	}
+
+	*res_cached_len = cached_len;
+	*res_uncached_len = uncached_len;
+	*res_n_sgrs = n_sgrs;
+}
+
+
+/* do a and b have the same cells, in the same display states? */
+static int sgr_compare(ansr_t *a, ansr_t *b)
+{
+	if (a->height != b->height)
+		return -1;
+
+	for (unsigned y = 0; y < a->height; y++) {
+		unsigned	width = a->rows[y] ? a->rows[y]->width : 0;
+
+		if (width != (b->rows[y] ? b->rows[y]->width : 0))
+			return -1;
+
+		for (unsigned x = 0; x < width; x++) {
+			uint16_t	a_handle, b_handle;
+			char		a_code, b_code;
+
+			ansr_cell(a, x, y, &a_code, &a_handle);
+			ansr_cell(b, x, y, &b_code, &b_handle);
+			if (a_code != b_code ||
+			    memcmp(&a->disp_states[a_handle], &b->disp_states[b_handle], sizeof(ansr_disp_state_t)))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* write input to a new instance, expecting the given cache counts */
+static int sgr_counts(const char *name, const char *input, unsigned hits, unsigned misses)
+{
+	ansr_stats_t	stats;
+	ansr_t		*ansr;
+
+	ansr = ansr_new(NULL, (char *)input, strlen(input));
+	if (!ansr)
+		return -1;
+
+	ansr_stats(ansr, &stats);
+	ansr_free(ansr);
+
+	if (stats.sgr_cache_hits != hits || stats.sgr_cache_misses != misses) {
+		printf("%s: %u hits, %u misses, expected %u and %u\n", name, stats.sgr_cache_hits, stats.sgr_cache_misses, hits, misses);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	static char	cached[INPUT_MAX], uncached[INPUT_MAX];
+	ansr_stats_t	stats;
+	ansr_t		*ansr;
+	int		failed = 0;
+
+	/* counts of known inputs */
+	if (sgr_counts("repeat", "\x1b[1;31mx\x1b[1;31mx\x1b[1;31mx\x1b[1;31mx", 3, 1) < 0 ||
+	    sgr_counts("alternating", "\x1b[1;31mx\x1b[0;44mx\x1b[1;31mx\x1b[0;44mx\x1b[1;31mx", 3, 2) < 0 ||
+	    sgr_counts("empty", "\x1b[mx\x1b[0mx", 1, 1) < 0 ||
+	    sgr_counts("too long", "\x1b[1;1;1;1;1;1;1;1;31mx\x1b[1;1;1;1;1;1;1;1;31mx", 0, 0) < 0 ||
+	    sgr_counts("skipped params", "\x1b[1;38;5;200mx\x1b[1;38;5;200mx", 0, 2) < 0)
+		failed = 1;
+
+	/* counts restart on ansr_reset(), the cache itself stays valid */
+	ansr = ansr_new(NULL, "\x1b[1;31mx\x1b[1;31mx", 16);
+	if (!ansr || ansr_reset(ansr, NULL) < 0 || ansr_write(ansr, "\x1b[1;31mx", 8) < 0)
+		return EXIT_FAILURE;
+
+	ansr_stats(ansr, &stats);
+	ansr_free(ansr);
+	if (stats.sgr_cache_hits != 1 || stats.sgr_cache_misses != 0) {
+		printf("reset: %u hits, %u misses, expected 1 and 0\n", stats.sgr_cache_hits, stats.sgr_cache_misses);
+		failed = 1;
+	}
+
+	/* generated inputs must render the same through the cache as around it */
+	rng = 0x9e3779b97f4a7c15ull;
+	for (unsigned i = 0; i < SGR_INPUTS; i++) {
+		ansr_conf_t	conf = { .screen_width = 80, .sparse = i % 2 };
+		ansr_stats_t	cached_stats, uncached_stats;
+		size_t		cached_len, uncached_len;
+		ansr_t		*a, *b;
+		unsigned	n_sgrs;
+
+		sgr_generate(cached, &cached_len, uncached, &uncached_len, &n_sgrs);
+		a = ansr_new(&conf, cached, cached_len);
+		b = ansr_new(&conf, uncached, uncached_len);
+		if (!a || !b)
+			return EXIT_FAILURE;
+
+		ansr_stats(a, &cached_stats);
+		ansr_stats(b, &uncached_stats);
+
+		if (sgr_compare(a, b) < 0) {
+			printf("input %u: the canvas differs with and without the cache\n", i);
+			failed = 1;
+		}
+
+		if (cached_stats.sgr_cache_hits + cached_stats.sgr_cache_misses != n_sgrs ||
+		    !cached_stats.sgr_cache_hits ||
+		    uncached_stats.sgr_cache_hits || uncached_stats.sgr_cache_misses) {
+			printf("input %u: %u SGRs gave %u hits and %u misses cached, %u and %u uncached\n",
+				i, n_sgrs, cached_stats.sgr_cache_hits, cached_stats.sgr_cache_misses,
+				uncached_stats.sgr_cache_hits, uncached_stats.sgr_cache_misses);
+			failed = 1;
+		}
+
+		ansr_free(b);
+		ansr_free(a);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/*
+ *  Copyright (C) 2022 - Vito Caputo - <vcaputo@pengaru.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License version 3 as published
+ *  by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* unsupported input test: each kind of unsupported input must be skipped
+ * without disturbing the text around it, counted in its counter of
+ * ansr_stats_t.unsupported and no other, and fail ansr_write() with
+ * -ENOTSUP in conf.strict, once the text before it is written.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ansr.h"
+
+#define N_COUNTERS	(sizeof(ansr_unsupported_t) / sizeof(unsigned))
+
+typedef struct unsupported_case_t {
+	const char	*name;
+	const char	*input;
+	const char	*text;		/* row 0 afterwards */
+	size_t		counter;	/* offset into ansr_unsupported_t */
+	unsigned	count;
+} unsupported_case_t;
+
+
+/* check ansr's row 0 is text, and its counters are zero except counter at count */
+static int unsupported_check(const char *name, ansr_t *ansr, const char *text, size_t counter, unsigned count)
+{
+	size_t		len = strlen(text);
+	ansr_stats_t	stats;
+	unsigned	counters[N_COUNTERS];
+
+	if (!ansr->height || !ansr->rows[0] || ansr->rows[0]->width != len) {
+		printf("%s: row 0 isn't \"%s\"\n", name, text);
+		return -1;
+	}
+
+	for (unsigned x = 0; x < len; x++) {
+		uint16_t	handle;
+		char		code;
+
+		ansr_cell(ansr, x, 0, &code, &handle);
+		if (code != text[x]) {
+			printf("%s: row 0 isn't \"%s\"\n", name, text);
+			return -1;
+		}
+	}
+
+	ansr_stats(ansr, &stats);
+	memcpy(counters, &stats.unsupported, sizeof(counters));
+	for (unsigned i = 0; i < N_COUNTERS; i++) {
+		unsigned	expected = i * sizeof(unsigned) == counter ? count : 0;
+
+		if (counters[i] != expected) {
+			printf("%s: counter at offset %zu is %u, expected %u\n", name, i * sizeof(unsigned), counters[i], expected);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	unsupported_case_t	cases[] = {
+		{ "FF", "a\fb", "ab", offsetof(ansr_unsupported_t, controls), 1 },
+		{ "RIS", "a\x1b" "cb", "ab", offsetof(ansr_unsupported_t, escapes), 1 },
+		{ "designate G0", "a\x1b(Bb", "ab", offsetof(ansr_unsupported_t, escapes), 1 },
+		{ "scroll up", "a\x1b[2Sb", "ab", offsetof(ansr_unsupported_t, csi['S' - 0x40]), 1 },
+		{ "set margins", "a\x1b[1;5rb\x1b[r", "ab", offsetof(ansr_unsupported_t, csi['r' - 0x40]), 2 },
+		{ "private mode", "a\x1b[?25hb", "ab", offsetof(ansr_unsupported_t, csi_private), 1 },
+		{ "intermediate", "a\x1b[1 qb", "ab", offsetof(ansr_unsupported_t, csi_private), 1 },
+		{ "alt font", "a\x1b[1;12mb\x1b[1;12m", "ab", offsetof(ansr_unsupported_t, sgr[12]), 2 },
+		{ "256 color", "a\x1b[38;5;200mb", "ab", offsetof(ansr_unsupported_t, sgr[38]), 1 },
+		{ "rgb color", "a\x1b[48;2;1;2;3mb", "ab", offsetof(ansr_unsupported_t, sgr[48]), 1 },
+		{ "SGR 200", "a\x1b[200mb", "ab", offsetof(ansr_unsupported_t, sgr_other), 1 },
+		{ "17 params", "a\x1b[1;1;1;1;1;1;1;1;1;1;1;1;1;1;1;1;1mb", "ab", offsetof(ansr_unsupported_t, malformed), 1 },
+		{ "param over 16 bits", "a\x1b[70000Cb", "ab", offsetof(ansr_unsupported_t, malformed), 1 },
+		{ "cut short CSI", "a\x1b[1\x1b[mb", "ab", offsetof(ansr_unsupported_t, malformed), 1 },
+		{ "cut short escape", "a\x1b\x1b[mb", "ab", offsetof(ansr_unsupported_t, malformed), 1 },
+	};
+	char	supported[] = "a\x1b[1;31mb\x1b[2J\x07\x1b[44m\x1b[38;5;9mc\x1b[0K";
+	int	failed = 0;
+
+	for (unsigned i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+		ansr_conf_t	conf = {};
+		ansr_t		*ansr;
+		int		r;
+
+		ansr = ansr_new(&conf, (char *)cases[i].input, strlen(cases[i].input));
+		if (!ansr) {
+			printf("%s: ansr_new() failed\n", cases[i].name);
+			failed = 1;
+			continue;
+		}
+
+		if (unsupported_check(cases[i].name, ansr, cases[i].text, cases[i].counter, cases[i].count) < 0)
+			failed = 1;
+
+		ansr_free(ansr);
+
+		/* strict mode stops at the first, with what's before it written */
+		conf.strict = 1;
+		ansr = ansr_new(&conf, NULL, 0);
+		if (!ansr)
+			return EXIT_FAILURE;
+
+		r = ansr_write(ansr, (char *)cases[i].input, strlen(cases[i].input));
+		if (r != -ENOTSUP) {
+			printf("%s: strict ansr_write() returned %i, not -ENOTSUP\n", cases[i].name, r);
+			failed = 1;
+		} else if (unsupported_check(cases[i].name, ansr, "a", cases[i].counter, 1) < 0) {
+			failed = 1;
+		}
+
+		ansr_free(ansr);
+	}
+
+	/* and doesn't mind supported input */
+	{
+		ansr_conf_t	conf = { .strict = 1 };
+		ansr_t		*ansr;
+
+		ansr = ansr_new(&conf, NULL, 0);
+		if (!ansr)
+			return EXIT_FAILURE;
+
+		if (ansr_write(ansr, supported, strlen(supported)) < 0) {
+			printf("supported input failed in strict mode\n");
+			failed = 1;
+		} else if (unsupported_check("supported", ansr, "abc", 0, 0) < 0) {
+			failed = 1;
+		}
+
+		ansr_free(ansr);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}